@@ -0,0 +1,77 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// An open audio file, shared by the FFmpeg scan and the TagLib writers,
+// so each file is opened once and its metadata is still cached when the
+// tags are written.
+class FileHandle
+{
+public:
+    FileHandle(const std::string &path, bool write = false);
+    ~FileHandle();
+    FileHandle(const FileHandle &) = delete;
+    FileHandle &operator=(const FileHandle &) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+    bool isReadOnly() const { return readOnly; }
+    int duplicate() const;
+    long read(void *buffer, long size);
+    int64_t seek(int64_t offset, int whence);
+    int64_t size() const;
+
+private:
+    int fd = -1;
+    bool readOnly = false;
+};
+
+// Copy-on-write clones for atomic tag updates (btrfs, XFS, ...)
+std::string file_clone(const std::string &path);
+bool file_replace(const std::string &clone, const std::string &path);
+void file_discard(const std::string &clone);
+
+// Durability of tag writes
+bool file_sync(const std::string &path);
+bool file_sync_dir(const std::string &path);
+bool file_sync_fs(const std::vector<std::string> &paths);
+
+// Disk order of tag writes
+bool file_location(const std::string &path, uint64_t &device, uint64_t &offset);
+std::string file_device(const std::string &path);
+
+// Result store keys
+bool file_signature(const std::string &path, uint64_t &size, uint64_t &hash);
+
+#endif
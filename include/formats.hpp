@@ -0,0 +1,56 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include <scan.hpp>
+
+// What sets a format apart outside its writer. Padding, -I and -s are
+// the writers' business, each knows which of them apply.
+enum FORMAT_FLAGS
+{
+    FORMAT_R128 = 1     // Opus: R128_*_GAIN in Q7.8 instead of REPLAYGAIN_*
+};
+
+// One entry per taggable container (and codec, where the container
+// doesn't decide), resolved once per file by format_find().
+struct FormatTraits
+{
+    const char *name;       // for reports
+    const char *demuxer;    // AVInputFormat::name
+    AVCodecID codec;        // AV_CODEC_ID_NONE: any codec
+    unsigned int flags;
+    bool (*write)(AudioFile *audio_file, LoudGain &lg);
+    bool (*clear)(AudioFile *audio_file, LoudGain &lg);
+};
+
+const FormatTraits *format_find(const char *demuxer, AVCodecID codec);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef JSONLINES_H
+#define JSONLINES_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <scan.hpp>
+
+// JSON Lines output: every worker formats its records into its own
+// buffer (no lock), full buffers are handed to one writer thread.
+class JsonLines
+{
+public:
+    JsonLines() { }
+    ~JsonLines();
+    JsonLines(const JsonLines &) = delete;
+    JsonLines &operator=(const JsonLines &) = delete;
+
+    bool open(const std::string &path, int threads);
+    bool isOpen() const { return file != NULL; }
+    void addTrack(const AudioFile &audio_file);
+    void addAlbum(const AudioFile &audio_file);
+    void close();
+
+private:
+    // one per OpenMP thread, on its own cache line
+    struct alignas(64) Buffer
+    {
+        std::string data;
+    };
+
+    Buffer &buffer();
+    void flush(Buffer &buffer);
+    void run();
+
+    FILE *file = NULL;
+    std::vector<Buffer> buffers;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::string> chunks;
+    bool stopping = false;
+};
+
+#endif
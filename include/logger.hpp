@@ -0,0 +1,90 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <string>
+
+enum LOG_LEVEL
+{
+    LOG_ERROR,      // stderr
+    LOG_WARNING,    // stderr
+    LOG_INFO        // stdout
+};
+
+// Errors and verbose messages of the workers. A message is formatted
+// into a fixed-size entry and queued in a lock-free ring buffer, which a
+// drain thread writes out; workers never wait for the terminal (or a
+// pipe). If the ring is full, the message is dropped and counted.
+//
+//     Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not open input";
+//
+// Before start() and after stop(), messages are written directly.
+class Log
+{
+public:
+    enum { MESSAGE_SIZE = 1000 };
+
+    struct Entry
+    {
+        int64_t time;       // microseconds since start()
+        int32_t fileId;     // -1: not about a file
+        uint16_t length;
+        uint8_t level;
+        char text[MESSAGE_SIZE];
+    };
+
+    Log(enum LOG_LEVEL level, int fileId = -1);
+    ~Log();
+    Log(const Log &) = delete;
+    Log &operator=(const Log &) = delete;
+
+    Log &operator<<(const char *s);
+    Log &operator<<(const std::string &s);
+    Log &operator<<(char c);
+    Log &operator<<(int n);
+    Log &operator<<(long n);
+    Log &operator<<(long long n);
+    Log &operator<<(unsigned int n);
+    Log &operator<<(unsigned long n);
+    Log &operator<<(unsigned long long n);
+    Log &operator<<(double d);
+
+    static void start(bool json);
+    static void stop();
+
+private:
+    void append(const char *s, size_t n);
+
+    Entry entry;
+};
+
+#endif
@@ -66,24 +66,45 @@
 #include <string.h>
 #include <fstream>
 #include <vector>
+#include <map>
 #include <algorithm>
 #include <scan.hpp>
+#include <resultstore.hpp>
+#include <jsonlines.hpp>
+#include <resultfile.hpp>
+#include <orderedoutput.hpp>
+#include <profile.hpp>
+#include <trace.hpp>
+#include <progress.hpp>
+#include <metrics.hpp>
 
 
 class LoudGain
 {
 public:
-    enum AV_CONTAINER_ID
+    enum DURABILITY
     {
-        AV_CONTAINER_ID_MP3,
-        AV_CONTAINER_ID_FLAC,
-        AV_CONTAINER_ID_OGG,
-        AV_CONTAINER_ID_MP4,
-        AV_CONTAINER_ID_ASF,
-        AV_CONTAINER_ID_WAV,
-        AV_CONTAINER_ID_WV,
-        AV_CONTAINER_ID_AIFF,
-        AV_CONTAINER_ID_APE
+        DURABILITY_NONE,
+        DURABILITY_FSYNC,
+        DURABILITY_BATCH
+    };
+
+    // --dry-run totals, per format and per device
+    struct PlanTotals
+    {
+        int files = 0;
+        int inPlace = 0;
+        int rewritten = 0;
+        int unchanged = 0;
+        long long bytes = 0;
+    };
+
+    // --targets: extra reference levels, reported next to ReplayGain
+    struct GainTarget
+    {
+        double reference;       // LUFS
+        double ceiling;         // dBTP
+        bool hasCeiling;        // else -p and -P apply
     };
 
     int  verbosity = 1;
@@ -94,13 +115,35 @@ public:
     bool lowerCaseTags = false;
     bool warnClipping = true;
     int id3v2Version = 4;
+    long tagPadding = 4096;
+    bool reflink = false;
+    enum DURABILITY durability = DURABILITY_NONE;
+    int durabilityBatch = 0;    // files per syncfs, 0 = per album
+    bool deferWrites = false;
+    bool dryRun = false;
+    std::vector<GainTarget> gainTargets;
+    int curveInterval = 0;      // ms between loudness curve points, 0 = off
+    int progressInterval = 0;   // seconds between progress lines, 0 = off
     double maxTruePeakLevel = -1.0;
     double pregain = 0.0;
     char tagMode = 's';
     char unit[3] = "dB";
     int numberOfThreads = 1;
-    const std::vector<std::string> av_container_names = {"mp3", "flac", "ogg", "mov,mp4,m4a,3gp,3g2,mj2", "asf", "wav", "wv", "aiff", "ape"};
+    int tagsUnchanged = 0;
+    int tagsRewritten = 0;
     std::ofstream csvfile;
+    ResultStore resultStore;
+    JsonLines jsonLines;
+    ResultFile resultFile;
+    OrderedOutput orderedOutput;
+    Profile profile;
+    Trace trace;
+    Progress progress;
+    Metrics metrics;
+    std::vector<std::string> syncPending;
+    std::vector<std::shared_ptr<AudioFile>> deferredWrites;
+    std::map<std::string, PlanTotals> planFormats;
+    std::map<std::string, PlanTotals> planDevices;
 
     LoudGain();
     ~LoudGain();
@@ -116,13 +159,49 @@ public:
     void setForceLowerCaseTags(bool enable);
     void setStripTags(bool enable);
     void setID3v2Version(int version);
+    void setTagPadding(long padding);
+    void setReflink(bool enable);
+    void setDurability(const std::string &policy);
+    void setDeferWrites(bool enable);
+    void setDryRun(bool enable);
+    void setCurveInterval(int ms);
+    void setProfile(bool enable);
+    void setProgress(int seconds);
+    void openTrace(const std::string &file);
+    void closeTrace();
+    void openMetrics(const std::string &file, int interval);
+    void closeMetrics();
+    void prepareFile(AudioFile &audio_file, int fileId);
+    bool writesInPlace() const;
+    void fileScanned(const AudioFile &audio_file, uint64_t start);
+    void setGainTargets(const std::string &targets);
     void setTabOutput(bool enable);
     void openCsvFile(const std::string &file);
     void closeCsvFile();
+    void openResultStore(const std::string &file);
+    void closeResultStore();
+    void openJsonLines(const std::string &file);
+    void closeJsonLines();
+    void openResultFile(const std::string &file);
+    void closeResultFile();
+    void setOrderedOutput(bool enable);
+    void completeOutput(int first, int count = 1);
+    void emit(int fileId, OrderedOutput::STREAM stream, const std::string &text);
     void setNumberOfThreads(int n);
-    int  avContainerNameToId(const std::string &str);
+    bool tagFormatSupported(const AudioFile &audio_file);
+    bool beginTagWrite(AudioFile &audio_file, bool (*save)(AudioFile *, LoudGain &));
+    bool endTagWrite(AudioFile &audio_file, bool written);
+    void syncTagWrites();
+    void countTagStatus(const AudioFile &audio_file);
+    void recordPlan(const AudioFile &audio_file);
+    void printPlan();
     void removeReplayGainTags(AudioFile &audio_file);
-    void processFileResults(AudioFile &audio_file);
+    void writeReplayGainTags(AudioFile &audio_file);
+    void deferTagWrite(const std::shared_ptr<AudioFile> &audio_file);
+    bool tagsDeferred(const AudioFile &audio_file) const;
+    void writeDeferredTags();
+    void writeAlbumTags(AudioFolder &audio_album);
+    void processFileResults(AudioFile &audio_file, bool writeTags = true);
     void processFolderResults(AudioFolder &audio_album);
 };
 
@@ -0,0 +1,66 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef LOUDNESSCURVE_H
+#define LOUDNESSCURVE_H
+
+#include <string>
+#include <stdint.h>
+
+// Momentary (400 ms) and short-term (3 s) loudness, sampled every
+// `interval` ms of audio during the scan. Each series is stored in 1/100
+// LU steps as the difference to the previous value, zigzag-mapped and
+// written as an LEB128 varint, so a steady passage costs a byte a point.
+// Silence (or anything below -200 LUFS) is stored as -200 LUFS.
+class LoudnessCurve
+{
+public:
+    int interval = 0;           // ms between points, 0 = not recorded
+    uint32_t points = 0;
+    std::string momentary;
+    std::string shortTerm;
+
+    void start(int sample_rate);
+    void add(double momentary_lufs, double shortterm_lufs);
+    void clear();
+
+    // frames to feed the meter before the next point is due
+    unsigned long due() const { return remaining; }
+    bool advance(unsigned long frames);
+
+private:
+    static void put(std::string &out, int32_t &last, double lufs);
+
+    unsigned long step = 0;
+    unsigned long remaining = 0;
+    int32_t lastMomentary = 0;
+    int32_t lastShortTerm = 0;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+class AudioFile;
+
+// --metrics: counters and latency histograms in the Prometheus text
+// format, for node_exporter's textfile collector. The file is replaced
+// (temporary file, then rename) every few seconds and once at exit.
+class Metrics
+{
+public:
+    Metrics() { }
+    ~Metrics();
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    bool open(const std::string &path, int interval);
+    bool isOpen() const { return !path.empty(); }
+    void addScan(const AudioFile &audio_file, uint64_t ns);
+    void addTagWrite(const AudioFile &audio_file, uint64_t ns, bool ok);
+    void addSkipped() { skipped.fetch_add(1, std::memory_order_relaxed); }
+    void close();
+
+private:
+    static const int BUCKETS = 14;     // the last one is +Inf
+
+    struct Histogram
+    {
+        std::atomic<uint64_t> buckets[BUCKETS] = {};
+        std::atomic<uint64_t> sumNs{0};
+
+        void add(uint64_t ns);
+    };
+
+    struct Codec
+    {
+        long long files = 0;
+        double audioSeconds = 0.0;
+        double decodeSeconds = 0.0;
+    };
+
+    void run();
+    bool write(bool running);
+
+    std::string path;
+    int interval = 0;
+    std::atomic<uint64_t> scanned{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> skipped{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> tagWrites{0};
+    std::atomic<uint64_t> tagRewrites{0};
+    std::atomic<uint64_t> tagsUnchanged{0};
+    std::atomic<uint64_t> tagFailures{0};
+    Histogram scanLatency;
+    Histogram tagLatency;
+    std::mutex codecMutex;
+    std::map<std::string, Codec> codecs;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ORDEREDOUTPUT_H
+#define ORDEREDOUTPUT_H
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <ostream>
+
+// Results in input order, whatever order the workers finish in (-x).
+// Every file has a slot, its index in the run; the records written for
+// it wait until all slots before it are complete. Completed slots that
+// wait beyond the memory limit, say behind one huge file, are spilled
+// to a temporary file, so the other workers needn't wait for it.
+class OrderedOutput
+{
+public:
+    enum STREAM
+    {
+        STREAM_STDOUT,
+        STREAM_CSV,
+        STREAMS
+    };
+
+    OrderedOutput() { }
+    ~OrderedOutput();
+    OrderedOutput(const OrderedOutput &) = delete;
+    OrderedOutput &operator=(const OrderedOutput &) = delete;
+
+    void open(std::ostream *csv, size_t memoryLimit = 16 * 1024 * 1024);
+    bool isOpen() const { return opened; }
+    size_t bufferedBytes() const { return buffered; }
+    void add(int slot, STREAM stream, const std::string &text);
+    void complete(int first, int count = 1);
+    void close();
+
+private:
+    struct Slot
+    {
+        std::string text[STREAMS];
+        long spilled[STREAMS] = {-1, -1};     // offset in the spill file
+        size_t length[STREAMS] = {0, 0};
+        bool done = false;
+    };
+
+    void spill(Slot &slot);
+    void unspill(Slot &slot);
+    void write(Slot &slot);
+    void flush(std::unique_lock<std::mutex> &lock, bool all);
+
+    bool opened = false;
+    std::ostream *csv = NULL;
+    size_t memoryLimit = 0;
+    std::map<int, Slot> slots;      // not written yet
+    int next = 0;
+    size_t buffered = 0;            // bytes held in memory
+    FILE *spillFile = NULL;
+    long spillEnd = 0;
+    bool flushing = false;
+    std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <stdint.h>
+
+class AudioFile;
+
+// Log-linear latency histogram in microseconds, after HdrHistogram:
+// exact below 32 us, then 32 linear steps per power of two (3% error).
+// Not thread-safe, each worker fills its own.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    void add(uint64_t ns);
+    void merge(const LatencyHistogram &other);
+    uint64_t count() const { return total; }
+    double percentile(double p) const;     // ms
+    double max() const { return double(maxUs) / 1000.0; }
+
+private:
+    static int bucket(uint64_t us);
+    static uint64_t value(int bucket);
+
+    std::vector<uint32_t> counts;   // allocated on first use
+    uint64_t total = 0;
+    uint64_t maxUs = 0;
+};
+
+// --profile: thread time per stage of the scan and of the tag writes,
+// totalled per format and codec, and per-file latency percentiles for
+// open, decode and tag write. Files time their own stages (see
+// AudioFile::lap), a finished file is added to its worker's table.
+class Profile
+{
+public:
+    enum STAGE
+    {
+        STAGE_OPEN,             // avformat_open_input, codec and meter setup
+        STAGE_STREAM_INFO,      // avformat_find_stream_info
+        STAGE_DEMUX,            // av_read_frame
+        STAGE_DECODE,           // avcodec_send_packet/receive_frame
+        STAGE_RESAMPLE,         // swresample to S16 in scanFrame
+        STAGE_METER,            // ebur128_add_frames
+        STAGE_QUERY,            // loudness, range and peak queries
+        STAGE_TAG_WRITE,
+        STAGE_COUNT
+    };
+
+    // per-file latencies, from the stages above
+    enum LATENCY
+    {
+        LATENCY_OPEN,           // open and stream info
+        LATENCY_DECODE,         // demux, decode, resample, meter
+        LATENCY_TAG_WRITE,
+        LATENCY_COUNT
+    };
+
+    static const char *stageName(STAGE stage);
+
+    static uint64_t now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void start(int threads);
+    bool isOn() const { return !tables.empty(); }
+    void addScan(const AudioFile &audio_file);
+    void addTagWrite(const AudioFile &audio_file, uint64_t ns);
+    void print();
+
+private:
+    struct Totals
+    {
+        long long files = 0;
+        long long tagWrites = 0;
+        uint64_t ns[STAGE_COUNT] = {};
+        LatencyHistogram latency[LATENCY_COUNT];
+    };
+
+    // one per OpenMP thread, on its own cache line; only that thread
+    // writes it, print() reads it once the workers are done
+    struct alignas(64) Table
+    {
+        std::map<std::string, Totals> totals;
+    };
+
+    void printLatency(const std::map<std::string, Totals> &merged);
+
+    Table &table();
+
+    std::vector<Table> tables;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RESULTFILE_H
+#define RESULTFILE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <resultformat.hpp>
+#include <scan.hpp>
+
+// Writes the binary result file, see resultformat.hpp. Rows are appended
+// to the current block under a short lock; a full block is swapped out
+// and written while the other workers fill the next one.
+class ResultFile
+{
+public:
+    ResultFile() { }
+    ~ResultFile();
+    ResultFile(const ResultFile &) = delete;
+    ResultFile &operator=(const ResultFile &) = delete;
+
+    bool open(const std::string &path);
+    bool isOpen() const { return file != NULL; }
+    void addTrack(const AudioFile &audio_file, bool album);
+    void addAlbum(const AudioFile &audio_file);
+    void close();
+
+private:
+    struct Block
+    {
+        std::vector<double> doubles[ResultBlockLayout::DOUBLES];
+        std::vector<uint32_t> path;
+        std::vector<uint32_t> name;
+        std::vector<uint16_t> format;
+        std::vector<uint16_t> codec;
+        std::vector<uint16_t> flags;
+        std::vector<int32_t> codecId;
+        std::string paths;
+        std::string nameStrings;    // written before the paths
+        std::map<std::string, uint16_t> names;
+
+        uint32_t rows() const { return uint32_t(flags.size()); }
+        uint16_t intern(const std::string &s);
+        void clear();
+    };
+
+    void add(const std::string &path, const std::string &format, AVCodecID codecId,
+             uint16_t flags, const double (&values)[ResultBlockLayout::DOUBLES]);
+    void write(Block &block);
+
+    FILE *file = NULL;
+    Block block;
+    std::mutex mutex;       // the current block
+    std::mutex fileMutex;   // the file
+    bool failed = false;
+};
+
+#endif
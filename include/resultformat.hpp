@@ -0,0 +1,113 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RESULTFORMAT_H
+#define RESULTFORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The binary result file (-b), shared by loudgain and loudgain-dump.
+// Native byte order (checked by the reader), every part 8-byte aligned,
+// so a reader can mmap() it and use the columns in place:
+//
+//   ResultFileHeader
+//   block*: ResultBlockHeader, then the columns of ResultBlockLayout
+//
+// Strings (paths, format and codec names) are in a per-block string
+// table, addressed by offset arrays with one more entry than strings.
+
+#define RESULT_FILE_MAGIC   "LGRESULT"
+#define RESULT_FILE_VERSION 1
+#define RESULT_FILE_ORDER   0x01020304
+#define RESULT_BLOCK_MAGIC  "LGB1"
+#define RESULT_BLOCK_ROWS   65536
+
+enum RESULT_FLAGS
+{
+    RESULT_ALBUM           = 1,     // album summary, path is the directory
+    RESULT_CLIPS           = 2,
+    RESULT_CLIP_PREVENTION = 4,
+    RESULT_HAS_ALBUM       = 8      // album* columns are valid
+};
+
+struct ResultFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+};
+
+struct ResultBlockHeader
+{
+    char magic[4];
+    uint32_t rows;
+    uint32_t names;         // format and codec names
+    uint32_t stringBytes;
+};
+
+// Offsets of the columns, from the start of the block header
+struct ResultBlockLayout
+{
+    enum { LOUDNESS, RANGE, PEAK, REFERENCE, GAIN, NEW_PEAK,
+           ALBUM_LOUDNESS, ALBUM_RANGE, ALBUM_PEAK, ALBUM_GAIN, DOUBLES };
+
+    size_t doubles[DOUBLES];    // double[rows] each
+    size_t path;                // uint32_t[rows + 1], into strings
+    size_t name;                // uint32_t[names + 1], into strings
+    size_t format;              // uint16_t[rows], into names
+    size_t codec;               // uint16_t[rows], into names
+    size_t flags;               // uint16_t[rows], RESULT_FLAGS
+    size_t codecId;             // int32_t[rows], FFmpeg's AVCodecID
+    size_t strings;             // char[stringBytes]
+    size_t size;                // of the whole block
+
+    static size_t align(size_t n) { return (n + 7) & ~size_t(7); }
+
+    ResultBlockLayout(uint32_t rows, uint32_t names, uint32_t stringBytes)
+    {
+        size_t at = align(sizeof(ResultBlockHeader));
+
+        for (size_t &column : doubles)
+        {
+            column = at;
+            at += align(rows * sizeof(double));
+        }
+        path = at;      at += align((rows + 1) * sizeof(uint32_t));
+        name = at;      at += align((names + 1) * sizeof(uint32_t));
+        format = at;    at += align(rows * sizeof(uint16_t));
+        codec = at;     at += align(rows * sizeof(uint16_t));
+        flags = at;     at += align(rows * sizeof(uint16_t));
+        codecId = at;   at += align(rows * sizeof(int32_t));
+        strings = at;   at += align(stringBytes);
+        size = at;
+    }
+};
+
+#endif
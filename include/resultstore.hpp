@@ -0,0 +1,110 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <scan.hpp>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Track and album results in an SQLite database, for libraries whose
+// files can't (or shouldn't) be tagged. Workers only queue a record, one
+// writer thread inserts them in large transactions.
+class ResultStore
+{
+public:
+    ResultStore() { }
+    ~ResultStore();
+    ResultStore(const ResultStore &) = delete;
+    ResultStore &operator=(const ResultStore &) = delete;
+
+    bool open(const std::string &path);
+    bool isOpen() const { return db != NULL; }
+    void addTrack(AudioFile &audio_file, bool album);   // takes its loudness curve
+    void addAlbum(const AudioFile &audio_file);
+    void close();
+
+private:
+    struct Record
+    {
+        bool album;
+        std::string path;       // file, or the album's directory
+        std::string directory;
+        std::string format;
+        std::string codec;
+        uint64_t size;
+        uint64_t signature;
+        double loudness;
+        double range;
+        double peak;
+        double reference;
+        double gain;
+        double newPeak;
+        bool clips;
+        bool clipPrevention;
+        bool hasAlbum;
+        double albumLoudness;
+        double albumRange;
+        double albumPeak;
+        double albumGain;
+        int curveInterval;
+        uint32_t curvePoints;
+        std::string momentary;
+        std::string shortTerm;
+        std::vector<TargetGain> targets;
+    };
+
+    void queue(Record &&record);
+    void run();
+    bool commit(const std::vector<Record> &batch);
+
+    sqlite3 *db = NULL;
+    sqlite3_stmt *insertTrack = NULL;
+    sqlite3_stmt *insertAlbum = NULL;
+    sqlite3_stmt *insertCurve = NULL;
+    sqlite3_stmt *insertTarget = NULL;
+    sqlite3_stmt *deleteCurve = NULL;
+    sqlite3_stmt *deleteTargets = NULL;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Record> pending;
+    bool stopping = false;
+    bool failed = false;
+};
+
+#endif
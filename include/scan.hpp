@@ -37,10 +37,15 @@
 #include <memory>
 #include <algorithm>
 #include <filesystem>
+#include <fileio.hpp>
+#include <loudnesscurve.hpp>
+#include <profile.hpp>
+#include <trace.hpp>
 
 namespace fs = std::filesystem;
 
 class LoudGain;
+struct FormatTraits;
 
 extern "C" {
     #include <ebur128.h>
@@ -52,6 +57,19 @@ extern "C" {
     #include <libavutil/opt.h>
 }
 
+// gains for one of the extra reference levels (--targets), from the
+// same measurements as the ReplayGain values
+struct TargetGain
+{
+    double reference = 0.0;     // LUFS
+    double trackGain = 0.0;
+    double newTrackPeak = 0.0;
+    bool trackLimited = false;  // lowered to keep the peak under the ceiling
+    double albumGain = 0.0;
+    double newAlbumPeak = 0.0;
+    bool albumLimited = false;
+};
+
 class AudioFile
 {
 public:
@@ -63,12 +81,23 @@ public:
         SUCCESS
     };
 
+    enum TAGSTATUS
+    {
+        WRITTEN,
+        UNCHANGED,
+        REWRITTEN
+    };
+
     enum SCANSTATUS scanStatus = SCANSTATUS::INIT;
+    enum TAGSTATUS tagStatus = TAGSTATUS::WRITTEN;
     std::string filePath;
+    std::string tagPath;    // what the tag writers open, see LoudGain::beginTagWrite
     std::string fileName;
+    int fileId = -1;        // index in the run, for the log
     std::string directory;
     enum AVCodecID avCodecId;
     std::string avFormat = "";
+    const FormatTraits *format = NULL;     // how to tag it, NULL if we can't
     double trackGain = 0.0;
     double trackPeak = 0.0;
     double newTrackPeak = 0.0;
@@ -83,16 +112,35 @@ public:
     bool albumClips = false;
     double loudnessReference = 0.0;
     bool clipPrevention = false;
+    std::vector<TargetGain> targetGains;    // one per LoudGain::gainTargets
     ebur128_state *eburState = NULL;
+    LoudnessCurve curve;            // set curve.interval to record one
+    bool profile = false;           // time the scan's stages, see profile.hpp
+    uint64_t stageTimes[Profile::STAGE_COUNT] = {};    // ns
+    Trace *trace = NULL;            // --trace, gets the scan's phases
+    double scannedSeconds = 0.0;    // audio decoded, for --progress
+    uint64_t scannedBytes = 0;      // read by the scan, for --metrics
+    std::unique_ptr<FileHandle> fileHandle;    // kept open from scan to tag write
+    bool writeInPlace = false;      // open fileHandle read-write, see LoudGain::writesInPlace
+    bool dryRun = false;            // tags only planned, see PlanStream in tag.cpp
+    long long plannedBytes = 0;     // what a save would have written
 
     AudioFile(const std::string &path);
     ~AudioFile();
 
     bool destroyEbuR128State();
+    bool openFile();
+    void closeFile();
+    bool probeFile(bool verbose);
     bool scanFile(double pregain, bool loudness, bool verbose);
 
 private:
     bool scanFrame(ebur128_state *ebur128, AVFrame *frame, SwrContext *swr);
+    void lap(Profile::STAGE stage);
+    void mark(const char *name, std::string args = std::string());
+
+    uint64_t lapStart = 0;
+    uint64_t markStart = 0;
 
 };
 
@@ -34,36 +34,36 @@
 extern "C" {
 #endif
 
-bool tag_write_mp3(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip, int id3v2version);
+bool tag_write_mp3(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip, int id3v2version, long padding);
 bool tag_clear_mp3(AudioFile *audio_file, bool strip, int id3v2version);
 
-bool tag_write_flac(AudioFile *audio_file, bool do_album, char mode, char *unit);
-bool tag_clear_flac(AudioFile *audio_file);
+bool tag_write_flac(AudioFile *audio_file, bool do_album, char mode, char *unit, long padding);
+bool tag_clear_flac(AudioFile *audio_file, long padding);
 
-bool tag_write_ogg_vorbis(AudioFile *audio_file, bool do_album, char mode, char *unit);
+bool tag_write_ogg_vorbis(AudioFile *audio_file, bool do_album, char mode, char *unit, long padding);
 bool tag_clear_ogg_vorbis(AudioFile *audio_file);
 
 bool tag_write_ogg_flac(AudioFile *audio_file, bool do_album, char mode, char *unit);
 bool tag_clear_ogg_flac(AudioFile *audio_file);
 
-bool tag_write_ogg_speex(AudioFile *audio_file, bool do_album, char mode, char *unit);
+bool tag_write_ogg_speex(AudioFile *audio_file, bool do_album, char mode, char *unit, long padding);
 bool tag_clear_ogg_speex(AudioFile *audio_file);
 
-bool tag_write_ogg_opus(AudioFile *audio_file, bool do_album, char mode, char *unit);
+bool tag_write_ogg_opus(AudioFile *audio_file, bool do_album, char mode, char *unit, long padding);
 bool tag_clear_ogg_opus(AudioFile *audio_file);
 
 bool tag_write_mp4(AudioFile *audio_file, bool do_album, char mode, char *unit,
-                   bool lowercase);
-bool tag_clear_mp4(AudioFile *audio_file);
+                   bool lowercase, long padding);
+bool tag_clear_mp4(AudioFile *audio_file, long padding);
 
 bool tag_write_asf(AudioFile *audio_file, bool do_album, char mode, char *unit,
                    bool lowercase);
 bool tag_clear_asf(AudioFile *audio_file);
 
-bool tag_write_wav(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip, int id3v2version);
+bool tag_write_wav(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip, int id3v2version, long padding);
 bool tag_clear_wav(AudioFile *audio_file, bool strip, int id3v2version);
 
-bool tag_write_aiff(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip, int id3v2version);
+bool tag_write_aiff(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip, int id3v2version, long padding);
 bool tag_clear_aiff(AudioFile *audio_file, bool strip, int id3v2version);
 
 bool tag_write_wavpack(AudioFile *audio_file, bool do_album, char mode, char *unit, bool lowercase, bool strip);
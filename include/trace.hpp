@@ -0,0 +1,83 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class AudioFile;
+
+// --trace: a Chrome trace-event / Perfetto timeline of what each worker
+// did when. Events go to the worker's own buffer without a lock and are
+// written as JSON when the run is done. Times come from Profile::now().
+class Trace
+{
+public:
+    Trace() { }
+    ~Trace();
+    Trace(const Trace &) = delete;
+    Trace &operator=(const Trace &) = delete;
+
+    bool open(const std::string &path, int threads);
+    bool isOn() const { return file != NULL; }
+
+    // `name` must be a literal; `args` are extra JSON members, e.g.
+    // "\"path\":\"...\"", see Trace::quote
+    void add(const char *name, int fileId, uint64_t begin, uint64_t end, std::string args = std::string());
+    void addFile(const char *name, const AudioFile &audio_file, uint64_t begin);   // until now
+    void close();
+
+    static std::string quote(const std::string &s);
+
+private:
+    struct Event
+    {
+        const char *name;
+        int fileId;
+        uint64_t begin;
+        uint64_t end;
+        std::string args;
+    };
+
+    // one per OpenMP thread, on its own cache line
+    struct alignas(64) Buffer
+    {
+        std::vector<Event> events;
+    };
+
+    FILE *file = NULL;
+    uint64_t origin = 0;
+    std::vector<Buffer> buffers;
+};
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fileio.hpp>
+
+#include <set>
+#include <fstream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#else
+#include <filesystem>
+#endif
+
+#ifdef __linux__
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <sys/sysmacros.h>
+#endif
+
+FileHandle::FileHandle(const std::string &path, bool write)
+{
+#ifndef _WIN32
+    // read-write only if TagLib will save through it later: closing a
+    // write-opened file wakes up library watchers (inotify IN_CLOSE_WRITE).
+    // The scan alone also works with read-only files.
+    if (write)
+        fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        readOnly = true;
+    }
+#else
+    (void) path;
+    (void) write;
+#endif
+}
+
+FileHandle::~FileHandle()
+{
+#ifndef _WIN32
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+// a descriptor for owners that close it themselves (TagLib::FileStream)
+int FileHandle::duplicate() const
+{
+#ifndef _WIN32
+    return fd >= 0 ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+#else
+    return -1;
+#endif
+}
+
+long FileHandle::read(void *buffer, long size)
+{
+#ifndef _WIN32
+    return long(::read(fd, buffer, size_t(size)));
+#else
+    (void) buffer; (void) size;
+    return -1;
+#endif
+}
+
+int64_t FileHandle::seek(int64_t offset, int whence)
+{
+#ifndef _WIN32
+    return int64_t(lseek(fd, off_t(offset), whence));
+#else
+    (void) offset; (void) whence;
+    return -1;
+#endif
+}
+
+int64_t FileHandle::size() const
+{
+#ifndef _WIN32
+    struct stat st;
+    return fstat(fd, &st) == 0 ? int64_t(st.st_size) : -1;
+#else
+    return -1;
+#endif
+}
+
+// Create a reflinked clone of `path` in the same directory (so it can be
+// renamed over the original later) and return its path. Returns "" if
+// the file system can't clone, or if replacing the file would change
+// more than its contents: hard links would be broken up, symlinks
+// replaced. Ownership and permissions are kept; extended attributes and
+// ACLs are not, so files having them are better written in place.
+std::string file_clone(const std::string &path)
+{
+#if defined(__linux__) && defined(FICLONE)
+    struct stat st;
+
+    if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_nlink > 1)
+        return "";
+
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    std::string clone = dir + "." + name + ".lgXXXXXX";
+
+    int src = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src < 0)
+        return "";
+
+    int dst = mkstemp(&clone[0]);
+    if (dst < 0)
+    {
+        close(src);
+        return "";
+    }
+
+    bool ok = ioctl(dst, FICLONE, src) == 0 &&
+              fchmod(dst, st.st_mode & 07777) == 0;
+
+    // only root may give files away, so a failure here is fine
+    // as long as the owner is us anyway
+    if (ok && fchown(dst, st.st_uid, st.st_gid) != 0)
+        ok = st.st_uid == geteuid();
+
+    close(dst);
+    close(src);
+
+    if (!ok)
+    {
+        unlink(clone.c_str());
+        return "";
+    }
+
+    return clone;
+#else
+    (void) path;
+    return "";
+#endif
+}
+
+// Atomically put the (now tagged) clone in place of the original.
+bool file_replace(const std::string &clone, const std::string &path)
+{
+#ifdef __linux__
+    if (rename(clone.c_str(), path.c_str()) == 0)
+        return true;
+
+    unlink(clone.c_str());
+#else
+    (void) clone; (void) path;
+#endif
+    return false;
+}
+
+// Drop a clone that wasn't needed after all.
+void file_discard(const std::string &clone)
+{
+#ifdef __linux__
+    unlink(clone.c_str());
+#else
+    (void) clone;
+#endif
+}
+
+// fsync() a file we just wrote.
+bool file_sync(const std::string &path)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+// fsync() the directory containing `path`, so a rename() is durable, too.
+bool file_sync_dir(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    return file_sync(slash == std::string::npos ? "." : path.substr(0, slash + 1));
+}
+
+// One syncfs() per file system the files in `paths` live on. Flushes all
+// dirty data there, but that is the point: a single flush instead of one
+// fsync() per file is what write-back caches cope with well.
+bool file_sync_fs(const std::vector<std::string> &paths)
+{
+#if defined(__linux__)
+    std::set<dev_t> synced;
+    bool ok = true;
+
+    for (const std::string &path : paths)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !synced.insert(st.st_dev).second)
+            continue;
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || syncfs(fd) != 0)
+            ok = false;
+        if (fd >= 0)
+            close(fd);
+    }
+
+    return ok;
+#elif !defined(_WIN32)
+    (void) paths;
+    sync();
+    return true;
+#else
+    (void) paths;
+    return false;
+#endif
+}
+
+// Where a file lives: its device, and the physical offset of its first
+// extent (where the tags usually are), so writes can go in disk order.
+// Falls back to the inode number where FIEMAP isn't supported, which
+// most file systems allocate in roughly ascending disk order, too.
+bool file_location(const std::string &path, uint64_t &device, uint64_t &offset)
+{
+#ifndef _WIN32
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    device = uint64_t(st.st_dev);
+    offset = uint64_t(st.st_ino);
+
+#if defined(__linux__) && defined(FS_IOC_FIEMAP)
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        alignas(struct fiemap) char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+        struct fiemap *fm = reinterpret_cast<struct fiemap *>(buf);
+
+        memset(buf, 0, sizeof(buf));
+        fm->fm_start = 0;
+        fm->fm_length = FIEMAP_MAX_OFFSET;
+        fm->fm_extent_count = 1;
+
+        if (ioctl(fd, FS_IOC_FIEMAP, fm) == 0 && fm->fm_mapped_extents > 0)
+            offset = fm->fm_extents[0].fe_physical;
+
+        close(fd);
+    }
+#endif
+
+    return true;
+#else
+    (void) path;
+    device = offset = 0;
+    return false;
+#endif
+}
+
+// A device's name for reports: "major:minor", as in /proc/self/mountinfo
+std::string file_device(const std::string &path)
+{
+#ifndef _WIN32
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0)
+        return "?";
+
+    return std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+#else
+    // drive letter, or the UNC server
+    std::filesystem::path root = std::filesystem::absolute(std::filesystem::u8path(path)).root_name();
+    return root.empty() ? std::string("?") : root.string();
+#endif
+}
+
+// Identifies a file's content cheaply: its size and an FNV-1a hash of its
+// first and last 64 KiB (where the tags are, and the audio's start and end).
+bool file_signature(const std::string &path, uint64_t &size, uint64_t &hash)
+{
+    const long block = 64 * 1024;
+    std::vector<char> buffer(block);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file.is_open())
+        return false;
+
+    size = uint64_t(file.tellg());
+    hash = 14695981039346656037ULL;
+
+    auto update = [&](uint64_t offset, long length) {
+        file.seekg(std::streamoff(offset));
+        file.read(buffer.data(), length);
+        for (std::streamsize i = 0; i < file.gcount(); i++)
+        {
+            hash ^= uint8_t(buffer[i]);
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    update(0, long(std::min<uint64_t>(size, block)));
+    if (size > uint64_t(block))
+        update(std::max<uint64_t>(block, size - block), long(std::min<uint64_t>(size - block, block)));
+
+    return !file.bad();
+}
@@ -0,0 +1,98 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+#include <loudgain.hpp>
+#include <formats.hpp>
+#include <tag.hpp>
+
+// Adding a format means adding a line here (and its tag_write_*/tag_clear_*),
+// the dispatch in LoudGain doesn't change.
+static constexpr FormatTraits format_traits[] =
+{
+    {"MP3", "mp3", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_mp3(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags, lg.stripTags, lg.id3v2Version, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_mp3(f, lg.stripTags, lg.id3v2Version); }},
+
+    {"FLAC", "flac", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_flac(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_flac(f, lg.tagPadding); }},
+
+    // Ogg: TagLib uses different File classes per codec
+    {"Opus", "ogg", AV_CODEC_ID_OPUS, FORMAT_R128,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_ogg_opus(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &) { return tag_clear_ogg_opus(f); }},
+
+    {"Ogg Vorbis", "ogg", AV_CODEC_ID_VORBIS, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_ogg_vorbis(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &) { return tag_clear_ogg_vorbis(f); }},
+
+    {"Ogg FLAC", "ogg", AV_CODEC_ID_FLAC, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_ogg_flac(f, lg.scanAlbum, lg.tagMode, lg.unit); },
+        [](AudioFile *f, LoudGain &) { return tag_clear_ogg_flac(f); }},
+
+    {"Speex", "ogg", AV_CODEC_ID_SPEEX, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_ogg_speex(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &) { return tag_clear_ogg_speex(f); }},
+
+    {"MP4", "mov,mp4,m4a,3gp,3g2,mj2", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_mp4(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_mp4(f, lg.tagPadding); }},
+
+    {"ASF", "asf", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_asf(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags); },
+        [](AudioFile *f, LoudGain &) { return tag_clear_asf(f); }},
+
+    {"WAV", "wav", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_wav(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags, lg.stripTags, lg.id3v2Version, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_wav(f, lg.stripTags, lg.id3v2Version); }},
+
+    {"AIFF", "aiff", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_aiff(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags, lg.stripTags, lg.id3v2Version, lg.tagPadding); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_aiff(f, lg.stripTags, lg.id3v2Version); }},
+
+    {"WavPack", "wv", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_wavpack(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags, lg.stripTags); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_wavpack(f, lg.stripTags); }},
+
+    {"APE", "ape", AV_CODEC_ID_NONE, 0,
+        [](AudioFile *f, LoudGain &lg) { return tag_write_ape(f, lg.scanAlbum, lg.tagMode, lg.unit, lg.lowerCaseTags, lg.stripTags); },
+        [](AudioFile *f, LoudGain &lg) { return tag_clear_ape(f, lg.stripTags); }},
+};
+
+// NULL if we can't tag this container/codec
+const FormatTraits *format_find(const char *demuxer, AVCodecID codec)
+{
+    for (const FormatTraits &traits : format_traits)
+        if (strcmp(traits.demuxer, demuxer) == 0 &&
+            (traits.codec == AV_CODEC_ID_NONE || traits.codec == codec))
+            return &traits;
+
+    return NULL;
+}
@@ -0,0 +1,283 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <logger.hpp>
+#include <charconv>
+#include <math.h>
+#include <jsonlines.hpp>
+#include <formats.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// a worker hands its buffer over once it's this big
+static const size_t chunkSize = 64 * 1024;
+
+JsonLines::~JsonLines()
+{
+    close();
+}
+
+// "-" writes to stdout
+bool JsonLines::open(const std::string &path, int threads)
+{
+    if (file != NULL)
+        return true;
+
+    file = (path == "-") ? stdout : fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        std::cerr << "Failed to open file: '" << path << "'" << std::endl;
+        return false;
+    }
+
+    buffers = std::vector<Buffer>(std::max<int>(1, threads));
+    for (Buffer &b : buffers)
+        b.data.reserve(chunkSize + 4096);
+
+    stopping = false;
+    writer = std::thread(&JsonLines::run, this);
+    return true;
+}
+
+void JsonLines::close()
+{
+    if (file == NULL)
+        return;
+
+    // the workers are done, take what's left in their buffers
+    for (Buffer &b : buffers)
+        if (!b.data.empty())
+            flush(b);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    if (file != stdout)
+        fclose(file);
+    else
+        fflush(file);
+    file = NULL;
+    buffers.clear();
+}
+
+JsonLines::Buffer &JsonLines::buffer()
+{
+#ifdef _OPENMP
+    return buffers[size_t(omp_get_thread_num()) % buffers.size()];
+#else
+    return buffers[0];
+#endif
+}
+
+void JsonLines::flush(Buffer &b)
+{
+    std::string chunk;
+    chunk.reserve(chunkSize + 4096);
+    chunk.swap(b.data);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks.push_back(std::move(chunk));
+    }
+    wake.notify_one();
+}
+
+void JsonLines::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;)
+    {
+        wake.wait(lock, [this] { return stopping || !chunks.empty(); });
+
+        if (chunks.empty())
+            break;
+
+        std::string chunk = std::move(chunks.front());
+        chunks.pop_front();
+        lock.unlock();
+
+        if (fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size())
+        {
+            Log(LOG_ERROR) << "Couldn't write JSON Lines output";
+        }
+
+        lock.lock();
+    }
+}
+
+static void put(std::string &out, const char *name)
+{
+    out += ",\"";
+    out += name;
+    out += "\":";
+}
+
+// shortest representation that reads back the same; -inf dBTP (digital
+// silence) and the like have no JSON number, they are null
+static void number(std::string &out, double value)
+{
+    if (!isfinite(value))
+    {
+        out += "null";
+        return;
+    }
+
+    char buf[32];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, r.ptr);
+#else
+    out.append(buf, size_t(snprintf(buf, sizeof(buf), "%.17g", value)));
+#endif
+}
+
+static void put(std::string &out, const char *name, double value)
+{
+    put(out, name);
+    number(out, value);
+}
+
+static void put(std::string &out, const char *name, bool value)
+{
+    put(out, name);
+    out += value ? "true" : "false";
+}
+
+// paths are written byte by byte; on Linux, that's not always UTF-8
+static void put(std::string &out, const char *name, const std::string &value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    put(out, name);
+    out += '"';
+    for (unsigned char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += char(c);
+        }
+        else if (c < 0x20)
+        {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+        else
+            out += char(c);
+    }
+    out += '"';
+}
+
+// --targets, the track's or the album's gains
+static void put(std::string &out, const char *name, const std::vector<TargetGain> &targets, bool album)
+{
+    put(out, name);
+    out += '[';
+    for (const TargetGain &gain : targets)
+    {
+        if (out.back() != '[')
+            out += ',';
+        out += "{\"reference\":";
+        number(out, gain.reference);
+        put(out, "gain", album ? gain.albumGain : gain.trackGain);
+        put(out, "new_peak", album ? gain.newAlbumPeak : gain.newTrackPeak);
+        put(out, "new_peak_dbtp", 20.0 * log10(album ? gain.newAlbumPeak : gain.newTrackPeak));
+        put(out, "limited", album ? gain.albumLimited : gain.trackLimited);
+        out += '}';
+    }
+    out += ']';
+}
+
+// same fields as the CSV output
+void JsonLines::addTrack(const AudioFile &audio_file)
+{
+    if (!isOpen())
+        return;
+
+    Buffer &b = buffer();
+    std::string &out = b.data;
+
+    out += "{\"type\":\"track\"";
+    put(out, "path", audio_file.filePath);
+    put(out, "format", std::string(audio_file.format != NULL ? audio_file.format->name : audio_file.avFormat.c_str()));
+    put(out, "codec", std::string(avcodec_get_name(audio_file.avCodecId)));
+    put(out, "loudness", audio_file.trackLoudness);
+    put(out, "range", audio_file.trackLoudnessRange);
+    put(out, "peak", audio_file.trackPeak);
+    put(out, "peak_dbtp", 20.0 * log10(audio_file.trackPeak));
+    put(out, "reference", audio_file.loudnessReference);
+    put(out, "clips", audio_file.trackClips || audio_file.albumClips);
+    put(out, "clip_prevention", audio_file.clipPrevention);
+    put(out, "gain", audio_file.trackGain);
+    put(out, "new_peak", audio_file.newTrackPeak);
+    put(out, "new_peak_dbtp", 20.0 * log10(audio_file.newTrackPeak));
+    if (!audio_file.targetGains.empty())
+        put(out, "targets", audio_file.targetGains, false);
+    out += "}\n";
+
+    if (out.size() >= chunkSize)
+        flush(b);
+}
+
+void JsonLines::addAlbum(const AudioFile &audio_file)
+{
+    if (!isOpen())
+        return;
+
+    Buffer &b = buffer();
+    std::string &out = b.data;
+
+    out += "{\"type\":\"album\"";
+    put(out, "directory", audio_file.directory);
+    put(out, "loudness", audio_file.albumLoudness);
+    put(out, "range", audio_file.albumLoudnessRange);
+    put(out, "peak", audio_file.albumPeak);
+    put(out, "peak_dbtp", 20.0 * log10(audio_file.albumPeak));
+    put(out, "reference", audio_file.loudnessReference);
+    put(out, "clips", audio_file.albumClips);
+    put(out, "clip_prevention", audio_file.clipPrevention);
+    put(out, "gain", audio_file.albumGain);
+    put(out, "new_peak", audio_file.newAlbumPeak);
+    put(out, "new_peak_dbtp", 20.0 * log10(audio_file.newAlbumPeak));
+    if (!audio_file.targetGains.empty())
+        put(out, "targets", audio_file.targetGains, true);
+    out += "}\n";
+
+    if (out.size() >= chunkSize)
+        flush(b);
+}
@@ -0,0 +1,303 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <logger.hpp>
+
+// A bounded multi-producer queue (Dmitry Vyukov's): each slot's sequence
+// tells producers whether it's free, and the consumer whether it's filled.
+// The one consumer is the drain thread.
+namespace
+{
+    const size_t ringSize = 2048;   // a power of 2, ~2 MB
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        Log::Entry entry;
+    };
+
+    std::unique_ptr<Slot[]> ring;
+    alignas(64) std::atomic<size_t> head(0);
+    alignas(64) size_t tail = 0;
+    std::atomic<bool> running(false);
+    std::atomic<unsigned long long> dropped(0);
+    std::thread drainer;
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    bool jsonFormat = false;
+}
+
+static bool ring_push(const Log::Entry &entry)
+{
+    size_t pos = head.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    for (;;)
+    {
+        slot = &ring[pos & (ringSize - 1)];
+        size_t seq = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+        if (diff == 0)
+        {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;   // full
+        else
+            pos = head.load(std::memory_order_relaxed);
+    }
+
+    // only the used part of the text
+    memcpy(&slot->entry, &entry, offsetof(Log::Entry, text) + entry.length);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+static bool ring_pop(Log::Entry &entry)
+{
+    Slot *slot = &ring[tail & (ringSize - 1)];
+
+    if (slot->sequence.load(std::memory_order_acquire) != tail + 1)
+        return false;
+
+    memcpy(&entry, &slot->entry, offsetof(Log::Entry, text) + slot->entry.length);
+    slot->sequence.store(tail + ringSize, std::memory_order_release);
+    tail++;
+    return true;
+}
+
+static void format(const Log::Entry &entry, std::string &out)
+{
+    static const char *levels[] = {"error", "warning", "info"};
+    static const char hex[] = "0123456789abcdef";
+
+    if (!jsonFormat)
+    {
+        out.append(entry.text, entry.length);
+        out += '\n';
+        return;
+    }
+
+    char buf[96];
+    snprintf(buf, sizeof(buf), "{\"time\":%.6f,\"level\":\"%s\",\"file\":%d,\"message\":\"",
+             entry.time / 1e6, levels[entry.level], int(entry.fileId));
+    out += buf;
+    for (uint16_t i = 0; i < entry.length; i++)
+    {
+        unsigned char c = (unsigned char) entry.text[i];
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += char(c);
+        }
+        else if (c < 0x20)
+        {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+        else
+            out += char(c);
+    }
+    out += "\"}\n";
+}
+
+static void drain()
+{
+    std::unique_ptr<Log::Entry> entry(new Log::Entry);
+    std::string out, err;
+    int idle = 0;
+
+    for (;;)
+    {
+        bool last = !running.load(std::memory_order_acquire);
+        int n = 0;
+
+        while (n < 256 && ring_pop(*entry))
+        {
+            format(*entry, entry->level == LOG_INFO ? out : err);
+            n++;
+        }
+
+        if (!err.empty())
+        {
+            fwrite(err.data(), 1, err.size(), stderr);
+            err.clear();
+        }
+        if (!out.empty())
+        {
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+            out.clear();
+        }
+
+        if (n > 0)
+            idle = 0;
+        else if (last)
+            break;
+        else
+        {
+            // nobody wakes us (that would take a lock): poll, backing off to 10 ms
+            idle = std::min<int>(idle + 1, 10);
+            std::this_thread::sleep_for(std::chrono::milliseconds(idle));
+        }
+    }
+}
+
+void Log::start(bool json)
+{
+    if (running)
+        return;
+
+    jsonFormat = json;
+    ring.reset(new Slot[ringSize]);
+    for (size_t i = 0; i < ringSize; i++)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    head.store(0);
+    tail = 0;
+    dropped.store(0);
+    startTime = std::chrono::steady_clock::now();
+
+    running.store(true, std::memory_order_release);
+    drainer = std::thread(drain);
+}
+
+// Only when the workers are done: drains what's left.
+void Log::stop()
+{
+    if (!running)
+        return;
+
+    running.store(false, std::memory_order_release);
+    drainer.join();
+    ring.reset();
+
+    if (dropped > 0)
+        fprintf(stderr, "%llu log message(s) dropped, the output couldn't keep up\n", dropped.load());
+}
+
+Log::Log(enum LOG_LEVEL level, int fileId)
+{
+    entry.time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - startTime).count();
+    entry.fileId = fileId;
+    entry.length = 0;
+    entry.level = uint8_t(level);
+}
+
+Log::~Log()
+{
+    if (running.load(std::memory_order_acquire))
+    {
+        if (!ring_push(entry))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::string line;
+    format(entry, line);
+    fwrite(line.data(), 1, line.size(), entry.level == LOG_INFO ? stdout : stderr);
+}
+
+// too long: truncated
+void Log::append(const char *s, size_t n)
+{
+    n = std::min<size_t>(n, MESSAGE_SIZE - entry.length);
+    memcpy(entry.text + entry.length, s, n);
+    entry.length += uint16_t(n);
+}
+
+Log &Log::operator<<(const char *s)
+{
+    append(s, strlen(s));
+    return *this;
+}
+
+Log &Log::operator<<(const std::string &s)
+{
+    append(s.data(), s.size());
+    return *this;
+}
+
+Log &Log::operator<<(char c)
+{
+    append(&c, 1);
+    return *this;
+}
+
+Log &Log::operator<<(int n)
+{
+    return *this << (long long) n;
+}
+
+Log &Log::operator<<(long n)
+{
+    return *this << (long long) n;
+}
+
+Log &Log::operator<<(long long n)
+{
+    char buf[24];
+    append(buf, size_t(snprintf(buf, sizeof(buf), "%lld", n)));
+    return *this;
+}
+
+Log &Log::operator<<(unsigned int n)
+{
+    return *this << (unsigned long long) n;
+}
+
+Log &Log::operator<<(unsigned long n)
+{
+    return *this << (unsigned long long) n;
+}
+
+Log &Log::operator<<(unsigned long long n)
+{
+    char buf[24];
+    append(buf, size_t(snprintf(buf, sizeof(buf), "%llu", n)));
+    return *this;
+}
+
+// as std::cout prints it, see main()
+Log &Log::operator<<(double d)
+{
+    char buf[32];
+    append(buf, size_t(snprintf(buf, sizeof(buf), "%.2f", d)));
+    return *this;
+}
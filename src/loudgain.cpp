@@ -61,11 +61,16 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <iostream>
+#include <sstream>
 #include <filesystem>
+#include <logger.hpp>
 #include <loudgain.hpp>
 #include <tag.hpp>
+#include <fileio.hpp>
+#include <formats.hpp>
 #include <thread>
 #include <algorithm>
+#include <map>
 
 namespace fs = std::filesystem;
 
@@ -75,7 +80,13 @@ LoudGain::LoudGain()
 
 LoudGain::~LoudGain()
 {
+    orderedOutput.close();
     closeCsvFile();
+    closeResultStore();
+    closeJsonLines();
+    closeResultFile();
+    closeTrace();
+    closeMetrics();
 }
 
 void LoudGain::setTagMode(const char tagmode)
@@ -133,6 +144,138 @@ void LoudGain::setID3v2Version(int version)
     id3v2Version = std::clamp<int>(version, 3, 4);
 }
 
+void LoudGain::setTagPadding(long padding)
+{
+    tagPadding = std::clamp<long>(padding, 0, 1024 * 1024);
+}
+
+void LoudGain::setReflink(bool enable)
+{
+    reflink = enable;
+}
+
+// none, fsync (per file) or batch[:N] (syncfs per N files, or per album)
+void LoudGain::setDurability(const std::string &policy)
+{
+    if (policy == "none")
+        durability = DURABILITY_NONE;
+    else if (policy == "fsync")
+        durability = DURABILITY_FSYNC;
+    else if (policy == "batch")
+    {
+        durability = DURABILITY_BATCH;
+        durabilityBatch = 0;
+    }
+    else if (policy.rfind("batch:", 0) == 0)
+    {
+        char *end;
+        long n = strtol(policy.c_str() + 6, &end, 10);
+        if (*end != '\0' || n < 1 || n > 1000000)
+        {
+            std::cerr << "Invalid durability batch size: " << policy << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        durability = DURABILITY_BATCH;
+        durabilityBatch = int(n);
+    }
+    else
+    {
+        std::cerr << "Invalid durability policy: " << policy << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// comma separated reference levels in LUFS, each with an optional true
+// peak ceiling in dBTP: "-23,-14:-1,-16:-1"
+void LoudGain::setGainTargets(const std::string &targets)
+{
+    gainTargets.clear();
+
+    size_t pos = 0;
+    while (pos <= targets.size())
+    {
+        size_t next = targets.find(',', pos);
+        if (next == std::string::npos)
+            next = targets.size();
+
+        std::string item = targets.substr(pos, next - pos);
+        GainTarget target = GainTarget();
+        char *end;
+
+        target.reference = strtod(item.c_str(), &end);
+        bool ok = end != item.c_str() && target.reference >= -70.0 && target.reference <= 0.0;
+        if (ok && *end == ':')
+        {
+            const char *ceiling = end + 1;
+            target.ceiling = strtod(ceiling, &end);
+            target.hasCeiling = true;
+            ok = end != ceiling && target.ceiling >= -32.0 && target.ceiling <= 3.0;
+        }
+
+        if (!ok || *end != '\0' || gainTargets.size() == 16)
+        {
+            std::cerr << "Invalid target: " << item << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        gainTargets.push_back(target);
+        pos = next + 1;
+    }
+}
+
+void LoudGain::setDeferWrites(bool enable)
+{
+    deferWrites = enable;
+}
+
+void LoudGain::setDryRun(bool enable)
+{
+    dryRun = enable;
+}
+
+void LoudGain::setProgress(int seconds)
+{
+    progressInterval = std::clamp(seconds, 0, 3600);
+}
+
+// after setNumberOfThreads
+void LoudGain::setProfile(bool enable)
+{
+    if (enable)
+        profile.start(numberOfThreads);
+}
+
+// what a worker sets on a file before scanning it
+void LoudGain::prepareFile(AudioFile &audio_file, int fileId)
+{
+    audio_file.fileId = fileId;
+    audio_file.curve.interval = curveInterval;
+    audio_file.profile = profile.isOn() || trace.isOn() || metrics.isOpen();
+    audio_file.trace = trace.isOn() ? &trace : NULL;
+    audio_file.writeInPlace = writesInPlace();
+}
+
+// Whether the tags are saved through the handle the scan opened. Not for
+// -S s, dry runs and deferred writes (the handle is closed before), nor
+// with reflinks (the writers save to the clone).
+bool LoudGain::writesInPlace() const
+{
+    bool writes = tagMode == 'd' || ((tagMode == 'i' || tagMode == 'e') && !deferWrites);
+    return writes && !dryRun && !reflink;
+}
+
+// `start` is from before the file was opened
+void LoudGain::fileScanned(const AudioFile &audio_file, uint64_t start)
+{
+    profile.addScan(audio_file);
+    metrics.addScan(audio_file, Profile::now() - start);
+}
+
+void LoudGain::setCurveInterval(int ms)
+{
+    curveInterval = ms > 0 ? std::clamp(ms, 10, 60000) : 0;
+}
+
 void LoudGain::setForceLowerCaseTags(bool enable)
 {
     lowerCaseTags = enable;
@@ -163,7 +306,10 @@ void LoudGain::openCsvFile(const std::string &file)
 
     /* Write headers */
     csvfile << "Type,Location,Loudness [LUFs],Range [" << unit << "],True Peak,True Peak [dBTP],Reference [LUFs],"
-            << "Will clip,Clip prevent,Gain [" << unit << "],New Peak,New Peak [dBTP]" << std::endl;
+            << "Will clip,Clip prevent,Gain [" << unit << "],New Peak,New Peak [dBTP]";
+    for (const GainTarget &target : gainTargets)
+        csvfile << ",Gain at " << target.reference << " LUFS [" << unit << "],New Peak at " << target.reference << " LUFS [dBTP]";
+    csvfile << std::endl;
 }
 
 void LoudGain::closeCsvFile()
@@ -175,6 +321,110 @@ void LoudGain::closeCsvFile()
     }
 }
 
+void LoudGain::openResultStore(const std::string &file)
+{
+    if (!resultStore.isOpen() && !resultStore.open(file))
+        exit(EXIT_FAILURE);
+}
+
+// waits until all queued results are committed
+void LoudGain::closeResultStore()
+{
+    resultStore.close();
+}
+
+// needs the number of threads, see setNumberOfThreads()
+void LoudGain::openJsonLines(const std::string &file)
+{
+    if (!jsonLines.open(file, numberOfThreads))
+        exit(EXIT_FAILURE);
+}
+
+void LoudGain::closeJsonLines()
+{
+    jsonLines.close();
+}
+
+// after setNumberOfThreads
+void LoudGain::openTrace(const std::string &file)
+{
+    if (!trace.open(file, numberOfThreads))
+        exit(EXIT_FAILURE);
+}
+
+void LoudGain::closeTrace()
+{
+    trace.close();
+}
+
+void LoudGain::openMetrics(const std::string &file, int interval)
+{
+    if (!metrics.open(file, interval))
+        exit(EXIT_FAILURE);
+}
+
+void LoudGain::closeMetrics()
+{
+    metrics.close();
+}
+
+void LoudGain::openResultFile(const std::string &file)
+{
+    if (!resultFile.open(file))
+        exit(EXIT_FAILURE);
+}
+
+void LoudGain::closeResultFile()
+{
+    resultFile.close();
+}
+
+// needs the CSV file opened first
+void LoudGain::setOrderedOutput(bool enable)
+{
+    if (enable)
+        orderedOutput.open(csvfile.is_open() ? &csvfile : NULL);
+    else
+        orderedOutput.close();
+}
+
+// The files first..first+count-1 (their index in the run) won't output
+// more, see OrderedOutput.
+void LoudGain::completeOutput(int first, int count)
+{
+    if (orderedOutput.isOpen())
+        orderedOutput.complete(first, count);
+}
+
+// A whole record in one write: no log message (see logger.hpp) can end
+// up in the middle of it. With -x, it waits for the files before it.
+void LoudGain::emit(int fileId, OrderedOutput::STREAM stream, const std::string &text)
+{
+    uint64_t start = trace.isOn() ? Profile::now() : 0;
+
+    if (orderedOutput.isOpen())
+        orderedOutput.add(fileId, stream, text);
+    else if (stream == OrderedOutput::STREAM_CSV)
+    {
+        #pragma omp critical
+        {
+            // the time it took to get the lock
+            if (trace.isOn())
+            {
+                uint64_t locked = Profile::now();
+                trace.add("output wait", fileId, start, locked);
+                start = locked;
+            }
+            csvfile << text << std::flush;
+        }
+    }
+    else
+        fwrite(text.data(), 1, text.size(), stdout);
+
+    if (trace.isOn())
+        trace.add("output", fileId, start, Profile::now());
+}
+
 void LoudGain::setNumberOfThreads(int n)
 {
     int maxt = std::thread::hardware_concurrency();
@@ -185,142 +435,356 @@ void LoudGain::setNumberOfThreads(int n)
         numberOfThreads = std::min<int>(n, maxt);
 }
 
-int LoudGain::avContainerNameToId(const std::string &str)
+// the format was resolved while scanning, see format_find()
+bool LoudGain::tagFormatSupported(const AudioFile &audio_file)
 {
-    if (str.length() == 0)
-        return -1;
+    if (audio_file.format != NULL)
+        return true;
 
-    for (int i = 0; i < (int) av_container_names.size(); i++)
-        if (av_container_names[i].find(str) != std::string::npos)
-            return i;
+    if (audio_file.avFormat.empty())
+        Log(LOG_ERROR, audio_file.fileId) << "Couldn't determine file format: " << audio_file.filePath;
+    else
+        Log(LOG_ERROR, audio_file.fileId) << "File type not supported: " << audio_file.avFormat << " ("
+                                          << avcodec_get_name(audio_file.avCodecId) << ")";
 
-    return -1;
+    return false;
 }
 
-void LoudGain::removeReplayGainTags(AudioFile &audio_file)
+// With reflinks enabled, the tag writers work on a copy-on-write clone,
+// which replaces the original only once the tags were written completely.
+// A crash then leaves either the old or the new file, never a torn one.
+// A clone costs a FICLONE and a temporary file, so the writer first runs
+// as a dry run on the original: files whose tags are already up to date
+// are never cloned. Returns false if there is nothing left to write.
+bool LoudGain::beginTagWrite(AudioFile &audio_file, bool (*save)(AudioFile *, LoudGain &))
 {
-    switch (avContainerNameToId(audio_file.avFormat))
+    audio_file.dryRun = dryRun;
+    audio_file.plannedBytes = 0;
+
+    if (!reflink || dryRun)
+        return true;
+
+    audio_file.dryRun = true;
+    bool planned = save(&audio_file, *this);
+    audio_file.dryRun = false;
+    audio_file.plannedBytes = 0;
+
+    if (planned && audio_file.tagStatus == AudioFile::TAGSTATUS::UNCHANGED)
+        return false;
+
+    audio_file.tagStatus = AudioFile::TAGSTATUS::WRITTEN;
+
+    std::string clone = file_clone(audio_file.filePath);
+    if (!clone.empty())
+        audio_file.tagPath = clone;
+    else if (verbosity >= 3)
     {
-    case -1:
-        #pragma omp critical
-        std::cerr << "Couldn't determine file format: " << audio_file.filePath << std::endl;
-        break;
-    case AV_CONTAINER_ID_MP3:
-        if (!tag_clear_mp3(&audio_file, stripTags, id3v2Version))
+        Log(LOG_INFO, audio_file.fileId) << "[" << audio_file.fileName << "] " << "Can't reflink, writing in place";
+    }
+
+    return true;
+}
+
+bool LoudGain::endTagWrite(AudioFile &audio_file, bool written)
+{
+    bool changed = written && audio_file.tagStatus != AudioFile::TAGSTATUS::UNCHANGED;
+    std::string path = audio_file.tagPath;
+
+    audio_file.tagPath = audio_file.filePath;
+
+    if (dryRun)
+    {
+        if (written)
+            recordPlan(audio_file);
+        return written;
+    }
+
+    if (path != audio_file.filePath)
+    {
+        if (!changed)
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            file_discard(path);
+            return written;
         }
-        break;
 
-    case AV_CONTAINER_ID_FLAC:
-        if (!tag_clear_flac(&audio_file))
+        // the clone's data must be on disk before it replaces the original,
+        // whatever --durability says: otherwise a crash after the rename
+        // can leave the file with missing data (XFS)
+        if (!file_sync(path))
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            file_discard(path);
+            return false;
         }
-        break;
 
-    case AV_CONTAINER_ID_OGG:
-        // must separate because TagLib uses fifferent File classes
-        switch (audio_file.avCodecId)
-        {
-        // Opus needs special handling (different RG tags, -23 LUFS ref.)
-        case AV_CODEC_ID_OPUS:
-            if (!tag_clear_ogg_opus(&audio_file))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
+        if (!file_replace(path, audio_file.filePath))
+            return false;
 
-        case AV_CODEC_ID_VORBIS:
-            if (!tag_clear_ogg_vorbis(&audio_file))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
+        if (durability == DURABILITY_FSYNC && !file_sync_dir(audio_file.filePath))
+            return false;
+    }
+    else if (changed && durability == DURABILITY_FSYNC && !file_sync(path))
+        return false;
 
-        case AV_CODEC_ID_FLAC:
-            if (!tag_clear_ogg_flac(&audio_file))
+    if (changed && durability == DURABILITY_BATCH)
+    {
+        #pragma omp critical (durability)
+        {
+            syncPending.push_back(audio_file.filePath);
+            if (durabilityBatch > 0 && int(syncPending.size()) >= durabilityBatch)
             {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+                file_sync_fs(syncPending);
+                syncPending.clear();
             }
-            break;
+        }
+    }
 
-        case AV_CODEC_ID_SPEEX:
-            if (!tag_clear_ogg_speex(&audio_file))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
+    return written;
+}
 
-        default:
-            #pragma omp critical
-            std::cerr << "Codec " << audio_file.avCodecId << " in " << audio_file.avFormat << " not supported" << std::endl;
-            break;
-        }
-        break;
+// flush a pending batch (end of album, end of run)
+void LoudGain::syncTagWrites()
+{
+    #pragma omp critical (durability)
+    {
+        if (!syncPending.empty() && !file_sync_fs(syncPending))
+            Log(LOG_ERROR) << "Couldn't sync tag writes to disk";
+        syncPending.clear();
+    }
+}
 
-    case AV_CONTAINER_ID_MP4:
-        if (!tag_clear_mp4(&audio_file))
-        {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-        }
-        break;
+// files whose tags were already up to date and did not need a save,
+// and files that had to be rewritten completely to make room for the tags
+void LoudGain::countTagStatus(const AudioFile &audio_file)
+{
+    if (audio_file.tagStatus == AudioFile::TAGSTATUS::UNCHANGED)
+    {
+        #pragma omp atomic
+        tagsUnchanged++;
+    }
+    else if (audio_file.tagStatus == AudioFile::TAGSTATUS::REWRITTEN)
+    {
+        #pragma omp atomic
+        tagsRewritten++;
 
-    case AV_CONTAINER_ID_ASF:
-        if (!tag_clear_asf(&audio_file))
+        if (verbosity >= 3 && !dryRun)
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            Log(LOG_INFO, audio_file.fileId) << "[" << audio_file.fileName << "] " << "Tags did not fit, file rewritten";
         }
-        break;
+    }
+}
+
+// What the tag writers would have done, had it not been a dry run
+void LoudGain::recordPlan(const AudioFile &audio_file)
+{
+    const char *plan = "in place";
+    std::string device = file_device(audio_file.filePath);
+
+    if (audio_file.tagStatus == AudioFile::TAGSTATUS::UNCHANGED)
+        plan = "tags up to date";
+    else if (audio_file.tagStatus == AudioFile::TAGSTATUS::REWRITTEN)
+        plan = "full rewrite";
 
-    case AV_CONTAINER_ID_WAV:
-        if (!tag_clear_wav(&audio_file, stripTags, id3v2Version))
+    #pragma omp critical (plan)
+    {
+        for (PlanTotals *totals : {&planFormats[audio_file.format->name], &planDevices[device]})
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            totals->files++;
+            totals->bytes += audio_file.plannedBytes;
+            if (audio_file.tagStatus == AudioFile::TAGSTATUS::UNCHANGED)
+                totals->unchanged++;
+            else if (audio_file.tagStatus == AudioFile::TAGSTATUS::REWRITTEN)
+                totals->rewritten++;
+            else
+                totals->inPlace++;
         }
-        break;
+    }
 
-    case AV_CONTAINER_ID_AIFF:
-        if (!tag_clear_aiff(&audio_file, stripTags, id3v2Version))
+    if (verbosity >= 2)
+    {
+        Log(LOG_INFO, audio_file.fileId) << "[" << audio_file.fileName << "] " << "Dry run: " << plan << ", "
+                                         << audio_file.plannedBytes << " bytes to write";
+    }
+}
+
+void LoudGain::printPlan()
+{
+    auto print = [](const std::string &heading, const std::map<std::string, PlanTotals> &plan) {
+        printf("%-12s %8s %8s %8s %8s %14s\n", heading.c_str(), "Files", "In place", "Rewrite", "Skip", "Bytes");
+        for (const auto &entry : plan)
+            printf("%-12s %8d %8d %8d %8d %14lld\n", entry.first.c_str(), entry.second.files,
+                   entry.second.inPlace, entry.second.rewritten, entry.second.unchanged, entry.second.bytes);
+    };
+
+    if (planFormats.empty())
+        return;
+
+    std::cout << "Dry run, no tags written:" << std::endl;
+    print("Format", planFormats);
+    print("Device", planDevices);
+}
+
+void LoudGain::removeReplayGainTags(AudioFile &audio_file)
+{
+    if (tagFormatSupported(audio_file))
+    {
+        if (beginTagWrite(audio_file, audio_file.format->clear)
+            && !endTagWrite(audio_file, audio_file.format->clear(&audio_file, *this)))
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            Log(LOG_ERROR, audio_file.fileId) << "Couldn't write to: " << audio_file.filePath;
         }
-        break;
+    }
+
+    audio_file.closeFile();
+    countTagStatus(audio_file);
+}
 
-    case AV_CONTAINER_ID_WV:
-        if (!tag_clear_wavpack(&audio_file, stripTags))
+void LoudGain::writeReplayGainTags(AudioFile &audio_file)
+{
+    if (tagFormatSupported(audio_file))
+    {
+        uint64_t start = Profile::now();
+
+        bool ok = !beginTagWrite(audio_file, audio_file.format->write)
+                  || endTagWrite(audio_file, audio_file.format->write(&audio_file, *this));
+        if (!ok)
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            Log(LOG_ERROR, audio_file.fileId) << "Couldn't write to: " << audio_file.filePath;
         }
-        break;
 
-    case AV_CONTAINER_ID_APE:
-        if (!tag_clear_ape(&audio_file, stripTags))
+        profile.addTagWrite(audio_file, Profile::now() - start);
+        trace.addFile("tag write", audio_file, start);
+        if (!dryRun)
+            metrics.addTagWrite(audio_file, Profile::now() - start, ok);
+    }
+    else
+        metrics.addSkipped();
+
+    countTagStatus(audio_file);
+}
+
+// The tracks of an album are independent files: write them as tasks, so
+// idle workers help instead of one worker saving a box set track by track.
+// The album scan runs as tasks, too (AudioLibrary::scanLibrary), so any
+// worker that finishes its file can take them.
+void LoudGain::writeAlbumTags(AudioFolder &audio_album)
+{
+    uint64_t start = Profile::now();
+
+#if defined(_OPENMP) && _OPENMP >= 200805
+    for (int i = 0; i < audio_album.count(); i++)
+    {
+        std::shared_ptr<AudioFile> audio_file = audio_album.getAudioFile(i);
+
+        #pragma omp task firstprivate(audio_file) if (numberOfThreads > 1)
         {
-            #pragma omp critical
-            std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
+            writeReplayGainTags(*audio_file);
+            audio_file->closeFile();
         }
-        break;
+    }
 
-    default:
-        #pragma omp critical
-        std::cerr << "File type not supported: " << audio_file.avFormat << std::endl;
-        break;
+    #pragma omp taskwait
+#else
+    // no tasks (MSVC: OpenMP 2.0)
+    for (int i = 0; i < audio_album.count(); i++)
+    {
+        writeReplayGainTags(*(audio_album.getAudioFile(i).get()));
+        audio_album.getAudioFile(i)->closeFile();
+    }
+#endif
+
+    if (trace.isOn())
+        trace.add("album tags", audio_album.getAudioFile(0)->fileId, start, Profile::now());
+}
+
+// Deferred writes: the scan only queues the files (their results, that
+// is; handles and EBU R128 states are released), the tags are written
+// once everything is scanned, in disk order, see writeDeferredTags().
+void LoudGain::deferTagWrite(const std::shared_ptr<AudioFile> &audio_file)
+{
+    if (!tagsDeferred(*audio_file))
+        return;
+
+    audio_file->closeFile();
+    audio_file->destroyEbuR128State();
+
+    #pragma omp critical (deferred)
+    deferredWrites.push_back(audio_file);
+}
+
+bool LoudGain::tagsDeferred(const AudioFile &audio_file) const
+{
+    return deferWrites && (tagMode == 'i' || tagMode == 'e') &&
+           audio_file.scanStatus == AudioFile::SCANSTATUS::SUCCESS;
+}
+
+void LoudGain::writeDeferredTags()
+{
+    struct Location
+    {
+        uint64_t device;
+        uint64_t start;     // first offset in the directory
+        uint64_t offset;
+        std::shared_ptr<AudioFile> audio_file;
+    };
+
+    std::vector<Location> order;
+    std::map<std::pair<uint64_t, std::string>, uint64_t> directories;
+
+    for (const std::shared_ptr<AudioFile> &audio_file : deferredWrites)
+    {
+        uint64_t device = 0, offset = 0;
+        file_location(audio_file->filePath, device, offset);
+        order.push_back({device, 0, offset, audio_file});
+
+        auto dir = directories.emplace(std::make_pair(device, audio_file->directory), offset);
+        if (!dir.second)
+            dir.first->second = std::min<uint64_t>(dir.first->second, offset);
     }
+    deferredWrites.clear();
+
+    // one directory after the other (in the order they're found on disk),
+    // and the files within a directory in disk order, too
+    for (Location &location : order)
+        location.start = directories[std::make_pair(location.device, location.audio_file->directory)];
+
+    std::sort(order.begin(), order.end(), [](const Location &a, const Location &b) {
+        if (a.device != b.device)
+            return a.device < b.device;
+        if (a.start != b.start)
+            return a.start < b.start;
+        if (a.audio_file->directory != b.audio_file->directory)
+            return a.audio_file->directory < b.audio_file->directory;
+        return a.offset < b.offset;
+    });
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        writeReplayGainTags(*order[i].audio_file);
+        resultStore.addTrack(*order[i].audio_file, scanAlbum);     // signed as saved
+        order[i].audio_file.reset();
+
+        // batch durability without a size: one flush per directory
+        if (durability == DURABILITY_BATCH && durabilityBatch == 0 &&
+            (i + 1 == order.size() || order[i + 1].start != order[i].start ||
+             order[i + 1].device != order[i].device))
+            syncTagWrites();
+    }
+}
+
+// gain to bring `loudness` to `reference`, lowered when the peak would
+// end up above the ceiling
+static double target_gain(double reference, double loudness, double peak, bool limit, double ceiling, bool &limited)
+{
+    double gain = reference - loudness;
+
+    limited = limit && peak > 0.0 && gain + 20.0 * log10(peak) > ceiling;
+    if (limited)
+        gain = ceiling - 20.0 * log10(peak);
+
+    return gain;
 }
 
-void LoudGain::processFileResults(AudioFile &audio_file)
+void LoudGain::processFileResults(AudioFile &audio_file, bool writeTags)
 {
     double tgain    = 1.0; // "gained" track peak
     double tpeak    = pow(10.0, maxTruePeakLevel / 20.0); // track peak limit
@@ -363,198 +827,140 @@ void LoudGain::processFileResults(AudioFile &audio_file)
     if (scanAlbum)
         audio_file.newAlbumPeak = pow(10.0, audio_file.albumGain / 20.0) * audio_file.albumPeak;
 
-    switch (tagMode)
+    // extra reference levels: the loudness is absolute, so no pre-gain
+    // and no Opus offset; the ceiling is the target's own, or -P with -p
+    audio_file.targetGains.clear();
+    for (const GainTarget &target : gainTargets)
     {
-    case 'i': /* ID3v2 tags */
-    case 'e': /* same as 'i' plus extra tags */
-        switch (avContainerNameToId(audio_file.avFormat))
+        bool limit = target.hasCeiling || preventClipping;
+        double ceiling = target.hasCeiling ? target.ceiling : maxTruePeakLevel;
+        TargetGain gain;
+
+        gain.reference = target.reference;
+        gain.trackGain = target_gain(target.reference, audio_file.trackLoudness, audio_file.trackPeak,
+                                     limit, ceiling, gain.trackLimited);
+        gain.newTrackPeak = pow(10.0, gain.trackGain / 20.0) * audio_file.trackPeak;
+        if (scanAlbum)
         {
-        case -1:
-            #pragma omp critical
-            std::cerr << "Couldn't determine file format: " << audio_file.filePath << std::endl;
-            break;
-
-        case AV_CONTAINER_ID_MP3:
-            if (!tag_write_mp3(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags, stripTags, id3v2Version))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
-
-        case AV_CONTAINER_ID_FLAC:
-            if (!tag_write_flac(&audio_file, scanAlbum, tagMode, unit))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
-
-        case AV_CONTAINER_ID_OGG:
-            // must separate because TagLib uses fifferent File classes
-            switch (audio_file.avCodecId)
-            {
-            // Opus needs special handling (different RG tags, -23 LUFS ref.)
-            case AV_CODEC_ID_OPUS:
-                if (!tag_write_ogg_opus(&audio_file, scanAlbum, tagMode, unit))
-                {
-                    #pragma omp critical
-                    std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-                }
-                break;
-
-            case AV_CODEC_ID_VORBIS:
-                if (!tag_write_ogg_vorbis(&audio_file, scanAlbum, tagMode, unit))
-                {
-                    #pragma omp critical
-                    std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-                }
-                break;
-
-            case AV_CODEC_ID_FLAC:
-                if (!tag_write_ogg_flac(&audio_file, scanAlbum, tagMode, unit))
-                {
-                    #pragma omp critical
-                    std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-                }
-                break;
-
-            case AV_CODEC_ID_SPEEX:
-                if (!tag_write_ogg_speex(&audio_file, scanAlbum, tagMode, unit))
-                {
-                    #pragma omp critical
-                    std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-                }
-                break;
-
-            default:
-                #pragma omp critical
-                std::cerr << "Codec " << audio_file.avCodecId << " in " << audio_file.avFormat << " not supported" << std::endl;
-                break;
-            }
-            break;
-
-        case AV_CONTAINER_ID_MP4:
-            if (!tag_write_mp4(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
-
-        case AV_CONTAINER_ID_ASF:
-            if (!tag_write_asf(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
-
-        case AV_CONTAINER_ID_WAV:
-            if (!tag_write_wav(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags, stripTags, id3v2Version))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
-
-        case AV_CONTAINER_ID_AIFF:
-            if (!tag_write_aiff(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags, stripTags, id3v2Version))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
-
-        case AV_CONTAINER_ID_WV:
-            if (!tag_write_wavpack(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags, stripTags))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
+            gain.albumGain = target_gain(target.reference, audio_file.albumLoudness, audio_file.albumPeak,
+                                         limit, ceiling, gain.albumLimited);
+            gain.newAlbumPeak = pow(10.0, gain.albumGain / 20.0) * audio_file.albumPeak;
+        }
 
-        case AV_CONTAINER_ID_APE:
-            if (!tag_write_ape(&audio_file, scanAlbum, tagMode, unit, lowerCaseTags, stripTags))
-            {
-                #pragma omp critical
-                std::cerr << "Couldn't write to: " << audio_file.filePath << std::endl;
-            }
-            break;
+        audio_file.targetGains.push_back(gain);
+    }
 
-        default:
-            #pragma omp critical
-            std::cerr << "File type not supported: " << audio_file.avFormat << std::endl;
-            break;
-        }
+    switch (tagMode)
+    {
+    case 'i': /* ID3v2 tags */
+    case 'e': /* same as 'i' plus extra tags */
+        // deferred or per album: the caller writes the tags
+        if (writeTags && !deferWrites)
+            writeReplayGainTags(audio_file);
         break;
 
     case 's': /* skip tags */
         break;
 
     default:
-        #pragma omp critical
-        std::cerr << "Invalid tag mode" << std::endl;
+        Log(LOG_ERROR, audio_file.fileId) << "Invalid tag mode";
         break;
     }
 
+    // done with the file, don't hold descriptors while albums finish
+    if (writeTags)
+        audio_file.closeFile();
+
+    // albums store their tracks once the album values are final, files
+    // whose tags are deferred once they're written (the signature covers
+    // the tags)
+    if (writeTags)
+    {
+        if (!tagsDeferred(audio_file))
+            resultStore.addTrack(audio_file, false);
+        resultFile.addTrack(audio_file, false);
+    }
+
     if (csvfile.is_open())
     {
-        #pragma omp critical
-        csvfile << "File,\"" << audio_file.filePath << "\"" << ","
-                << audio_file.trackLoudness << ","
-                << audio_file.trackLoudnessRange << ","
-                << audio_file.trackPeak << ","
-                << 20.0 * log10(audio_file.trackPeak) << ","
-                << audio_file.loudnessReference  << ","
-                << (audio_file.trackClips || audio_file.albumClips) << ","
-                << audio_file.clipPrevention << ","
-                << audio_file.trackGain << ","
-                << audio_file.newTrackPeak << ","
-                << 20.0 * log10(audio_file.newTrackPeak) << std::endl;
+        std::ostringstream out;
+        out.copyfmt(csvfile);
+
+        out << "File,\"" << audio_file.filePath << "\"" << ","
+            << audio_file.trackLoudness << ","
+            << audio_file.trackLoudnessRange << ","
+            << audio_file.trackPeak << ","
+            << 20.0 * log10(audio_file.trackPeak) << ","
+            << audio_file.loudnessReference  << ","
+            << (audio_file.trackClips || audio_file.albumClips) << ","
+            << audio_file.clipPrevention << ","
+            << audio_file.trackGain << ","
+            << audio_file.newTrackPeak << ","
+            << 20.0 * log10(audio_file.newTrackPeak);
+        for (const TargetGain &gain : audio_file.targetGains)
+            out << "," << gain.trackGain << "," << 20.0 * log10(gain.newTrackPeak);
+        out << "\n";
+
+        emit(audio_file.fileId, OrderedOutput::STREAM_CSV, out.str());
     }
 
+    jsonLines.addTrack(audio_file);
+
+    // each record goes out in one write, see emit()
     if (tabOutput)
     {
         // output new style list: File;Loudness;Range;Gain;Reference;Peak;Peak dBTP;Clipping;Clip-prevent
-        #pragma omp critical
+        char values[512];
+        snprintf(values, sizeof(values), "%.2f LUFS\t%.2f %s\t%.6f\t%.2f dBTP\t%.2f LUFS\t%s\t%s\t%.2f %s\t%.6f\t%.2f dBTP",
+                 audio_file.trackLoudness,
+                 audio_file.trackLoudnessRange, unit,
+                 audio_file.trackPeak,
+                 20.0 * log10(audio_file.trackPeak),
+                 audio_file.loudnessReference,
+                 (audio_file.trackClips || audio_file.albumClips) ? "Y" : "N",
+                 audio_file.clipPrevention ? "Y" : "N",
+                 audio_file.trackGain, unit,
+                 audio_file.newTrackPeak,
+                 20.0 * log10(audio_file.newTrackPeak));
+
+        std::string line = audio_file.filePath + "\t" + values;
+        for (const TargetGain &gain : audio_file.targetGains)
         {
-            printf("%s\t", audio_file.filePath.c_str());
-            printf("%.2f LUFS\t", audio_file.trackLoudness);
-            printf("%.2f %s\t", audio_file.trackLoudnessRange, unit);
-            printf("%.6f\t", audio_file.trackPeak);
-            printf("%.2f dBTP\t", 20.0 * log10(audio_file.trackPeak));
-            printf("%.2f LUFS\t", audio_file.loudnessReference);
-            printf("%s\t", (audio_file.trackClips || audio_file.albumClips) ? "Y" : "N");
-            printf("%s\t", audio_file.clipPrevention ? "Y" : "N");
-            printf("%.2f %s\t", audio_file.trackGain, unit);
-            printf("%.6f\t", audio_file.newTrackPeak);
-            printf("%.2f dBTP\n", 20.0 * log10(audio_file.newTrackPeak));
+            snprintf(values, sizeof(values), "\t%.2f %s\t%.2f dBTP", gain.trackGain, unit, 20.0 * log10(gain.newTrackPeak));
+            line += values;
         }
+
+        emit(audio_file.fileId, OrderedOutput::STREAM_STDOUT, line + "\n");
     }
     else if (verbosity >= 2)
     {
         // output something human-readable
-        #pragma omp critical
-        {
-            std::cout << "\nTrack: "   << audio_file.filePath << "\n"
-                      << " Loudness: " << audio_file.trackLoudness << " LUFS\n"
-                      << " Range:    " << audio_file.trackLoudnessRange << " dB\n"
-                      << " Peak:     " << audio_file.trackPeak << " (" << 20.0 * log10(audio_file.trackPeak) << " dBTP)\n";
+        std::ostringstream out;
+        out.copyfmt(std::cout);
 
-            if (audio_file.avCodecId == AV_CODEC_ID_OPUS)
-                std::cout << " Gain:     " <<  audio_file.trackGain << " dB ("  << gain_to_q78num(audio_file.trackGain) << ")";
-            else
-                std::cout << " Gain:     " << audio_file.trackGain <<  " dB";
+        out << "\nTrack: "   << audio_file.filePath << "\n"
+            << " Loudness: " << audio_file.trackLoudness << " LUFS\n"
+            << " Range:    " << audio_file.trackLoudnessRange << " dB\n"
+            << " Peak:     " << audio_file.trackPeak << " (" << 20.0 * log10(audio_file.trackPeak) << " dBTP)\n";
 
-            if (audio_file.clipPrevention)
-                std::cout << " (corrected to prevent clipping)";
+        if (audio_file.format != NULL && (audio_file.format->flags & FORMAT_R128))
+            out << " Gain:     " <<  audio_file.trackGain << " dB ("  << gain_to_q78num(audio_file.trackGain) << ")";
+        else
+            out << " Gain:     " << audio_file.trackGain <<  " dB";
 
-            if (!scanAlbum)
-                std::cout << "\n" << std::endl;
-            else
-                std::cout << std::endl;
-        }
+        if (audio_file.clipPrevention)
+            out << " (corrected to prevent clipping)";
+
+        for (const TargetGain &gain : audio_file.targetGains)
+            out << "\n Gain at " << gain.reference << " LUFS: " << gain.trackGain << " dB"
+                << (gain.trackLimited ? " (limited by the peak ceiling)" : "");
+
+        if (!scanAlbum)
+            out << "\n\n";
+        else
+            out << "\n";
+
+        emit(audio_file.fileId, OrderedOutput::STREAM_STDOUT, out.str());
     }
 }
 
@@ -562,85 +968,134 @@ void LoudGain::processFolderResults(AudioFolder &audio_album)
 {
     if (audio_album.count() == 0)
     {
-        #pragma omp critical
-        std::cerr << "No files in album!" << std::endl;
+        Log(LOG_ERROR) << "No files in album!";
         return;
     }
 
     if (audio_album.scanStatus != AudioFolder::SUCCESS)
     {
-        #pragma omp critical
-        std::cerr << "Album scan failed [" << audio_album.getAudioFile(0)->directory <<"]!" << std::endl;
+        Log(LOG_ERROR) << "Album scan failed [" << audio_album.getAudioFile(0)->directory <<"]!";
         return;
     }
 
     // check for different file (codec) types in an album and warn(including Opus might mess up album gain)
     if (audio_album.hasDifferentContainers() || audio_album.hasDifferentCodecs())
     {
-        #pragma omp critical
-        std::cerr << "You have different file types in the same album [" << audio_album.getAudioFile(0)->directory <<"]!" << std::endl;
+        Log(LOG_WARNING) << "You have different file types in the same album [" << audio_album.getAudioFile(0)->directory <<"]!";
 
         if (audio_album.hasOpus())
         {
-            #pragma omp critical
-            std::cerr << "Cannot calculate correct album gain when mixing Opus and non-Opus files [" << audio_album.getAudioFile(0)->directory <<"]!" << std::endl;
+            Log(LOG_ERROR) << "Cannot calculate correct album gain when mixing Opus and non-Opus files [" << audio_album.getAudioFile(0)->directory <<"]!";
             return;
         }
     }
 
+    // results in track order first, the tags are written afterwards
+    for (int i = 0; i < audio_album.count(); i++)
+        processFileResults(*(audio_album.getAudioFile(i).get()), false);
+
+    if (deferWrites)
+    {
+        for (int i = 0; i < audio_album.count(); i++)
+            deferTagWrite(audio_album.getAudioFile(i));
+    }
+    else if (tagMode == 'i' || tagMode == 'e')
+        writeAlbumTags(audio_album);
+
     for (int i = 0; i < audio_album.count(); i++)
     {
-        AudioFile &audio_file = *(audio_album.getAudioFile(i).get());
-        processFileResults(audio_file);
+        if (!tagsDeferred(*(audio_album.getAudioFile(i).get())))
+            resultStore.addTrack(*(audio_album.getAudioFile(i).get()), scanAlbum);
+        resultFile.addTrack(*(audio_album.getAudioFile(i).get()), scanAlbum);
+    }
+
+    if (scanAlbum)
+    {
+        resultStore.addAlbum(*(audio_album.getAudioFile(audio_album.count() - 1).get()));
+        resultFile.addAlbum(*(audio_album.getAudioFile(audio_album.count() - 1).get()));
+    }
+
+    // album summary once all its tracks are done
+    if (scanAlbum)
+    {
+        AudioFile &audio_file = *(audio_album.getAudioFile(audio_album.count() - 1).get());
+
+        jsonLines.addAlbum(audio_file);
+
+        if (csvfile.is_open())
+        {
+            std::ostringstream out;
+            out.copyfmt(csvfile);
+
+            out << "Album,\"" << audio_file.directory << "\"" << ","
+                << audio_file.albumLoudness << ","
+                << audio_file.albumLoudnessRange << ","
+                << audio_file.albumPeak << ","
+                << 20.0 * log10(audio_file.albumPeak) << ","
+                << audio_file.loudnessReference  << ","
+                << audio_file.albumClips << ","
+                << audio_file.clipPrevention << ","
+                << audio_file.albumGain << ","
+                << audio_file.newAlbumPeak << ","
+                << 20.0 * log10(audio_file.newAlbumPeak);
+            for (const TargetGain &gain : audio_file.targetGains)
+                out << "," << gain.albumGain << "," << 20.0 * log10(gain.newAlbumPeak);
+            out << "\n";
+
+            emit(audio_file.fileId, OrderedOutput::STREAM_CSV, out.str());
+        }
 
-        if (i == (audio_album.count() - 1) && scanAlbum)
+        if (tabOutput)
         {
-            #pragma omp critical
+            char values[512];
+            snprintf(values, sizeof(values), "Album\t%.2f LUFS\t%.2f %s\t%.6f\t%.2f dBTP\t%.2f LUFS\t%s\t%s\t%.2f %s\t%.6f\t%.2f dBTP",
+                     audio_file.albumLoudness,
+                     audio_file.albumLoudnessRange, unit,
+                     audio_file.albumPeak,
+                     20.0 * log10(audio_file.albumPeak),
+                     audio_file.loudnessReference,
+                     audio_file.albumClips ? "Y" : "N",
+                     audio_file.clipPrevention ? "Y" : "N",
+                     audio_file.albumGain, unit,
+                     audio_file.newAlbumPeak,
+                     20.0 * log10(audio_file.newAlbumPeak));
+
+            std::string line = values;
+            for (const TargetGain &gain : audio_file.targetGains)
             {
-                if (csvfile.is_open())
-                {
-                    csvfile << "Album,\"" << audio_file.directory << "\"" << ","
-                            << audio_file.albumLoudness << ","
-                            << audio_file.albumLoudnessRange << ","
-                            << audio_file.albumPeak << ","
-                            << 20.0 * log10(audio_file.albumPeak) << ","
-                            << audio_file.loudnessReference  << ","
-                            << audio_file.albumClips << ","
-                            << audio_file.clipPrevention << ","
-                            << audio_file.albumGain << ","
-                            << audio_file.newAlbumPeak << ","
-                            << 20.0 * log10(audio_file.newAlbumPeak) << std::endl;
-                }
-
-                if (tabOutput)
-                {
-                    printf("%s\t", "Album");
-                    printf("%.2f LUFS\t", audio_file.albumLoudness);
-                    printf("%.2f %s\t", audio_file.albumLoudnessRange, unit);
-                    printf("%.6f\t", audio_file.albumPeak);
-                    printf("%.2f dBTP\t", 20.0 * log10(audio_file.albumPeak));
-                    printf("%.2f LUFS\t", audio_file.loudnessReference);
-                    printf("%s\t", audio_file.albumClips ? "Y" : "N");
-                    printf("%s\t", audio_file.clipPrevention ? "Y" : "N");
-                    printf("%.2f %s\t", audio_file.albumGain, unit);
-                    printf("%.6f\t", audio_file.newAlbumPeak);
-                    printf("%.2f dBTP\n", 20.0 * log10(audio_file.newAlbumPeak));
-                }
-                else  if (verbosity >= 2)
-                {
-                    // output something human-readable
-                    std::cout << "\nAlbum: "   << audio_file.directory << "\n"
-                              << " Loudness: " << audio_file.albumLoudness << " LUFS\n"
-                              << " Range:    " << audio_file.albumLoudnessRange << " dB\n"
-                              << " Peak:     " << audio_file.albumPeak << " (" << 20.0 * log10(audio_file.albumPeak) << " dBTP)\n"
-                              << " Gain:     " << audio_file.albumGain <<  " dB\n";
-
-                    if (audio_file.clipPrevention)
-                        std::cout << " (corrected to prevent clipping)" << std::endl;
-                    else
-                        std::cout << std::endl;
-                }
+                snprintf(values, sizeof(values), "\t%.2f %s\t%.2f dBTP", gain.albumGain, unit, 20.0 * log10(gain.newAlbumPeak));
+                line += values;
             }
+
+            emit(audio_file.fileId, OrderedOutput::STREAM_STDOUT, line + "\n");
+        }
+        else  if (verbosity >= 2)
+        {
+            // output something human-readable
+            std::ostringstream out;
+            out.copyfmt(std::cout);
+
+            out << "\nAlbum: "   << audio_file.directory << "\n"
+                << " Loudness: " << audio_file.albumLoudness << " LUFS\n"
+                << " Range:    " << audio_file.albumLoudnessRange << " dB\n"
+                << " Peak:     " << audio_file.albumPeak << " (" << 20.0 * log10(audio_file.albumPeak) << " dBTP)\n"
+                << " Gain:     " << audio_file.albumGain <<  " dB\n";
+
+            if (audio_file.clipPrevention)
+                out << " (corrected to prevent clipping)\n";
+
+            for (const TargetGain &gain : audio_file.targetGains)
+                out << " Gain at " << gain.reference << " LUFS: " << gain.albumGain << " dB"
+                    << (gain.albumLimited ? " (limited by the peak ceiling)" : "") << "\n";
+
+            if (!audio_file.clipPrevention)
+                out << "\n";
+
+            emit(audio_file.fileId, OrderedOutput::STREAM_STDOUT, out.str());
         }
     }
+
+    // batch durability without a size: one flush per album
+    if (durability == DURABILITY_BATCH && durabilityBatch == 0)
+        syncTagWrites();
 }
@@ -0,0 +1,84 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <math.h>
+#include <algorithm>
+#include <loudnesscurve.hpp>
+
+void LoudnessCurve::start(int sample_rate)
+{
+    clear();
+    step = std::max<unsigned long>(1, (unsigned long) sample_rate * interval / 1000);
+    remaining = step;
+}
+
+// true when a point is due after feeding the meter `frames` more frames
+bool LoudnessCurve::advance(unsigned long frames)
+{
+    remaining -= frames;
+    if (remaining > 0)
+        return false;
+
+    remaining = step;
+    return true;
+}
+
+void LoudnessCurve::add(double momentary_lufs, double shortterm_lufs)
+{
+    put(momentary, lastMomentary, momentary_lufs);
+    put(shortTerm, lastShortTerm, shortterm_lufs);
+    points++;
+}
+
+void LoudnessCurve::clear()
+{
+    points = 0;
+    lastMomentary = lastShortTerm = 0;
+    std::string().swap(momentary);
+    std::string().swap(shortTerm);
+}
+
+void LoudnessCurve::put(std::string &out, int32_t &last, double lufs)
+{
+    // also catches -HUGE_VAL from an empty window and NaN
+    if (!(lufs > -200.0))
+        lufs = -200.0;
+
+    int32_t value = (int32_t) lrint(std::min(lufs, 200.0) * 100.0);
+    int32_t delta = value - last;
+    uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+    last = value;
+
+    while (zigzag >= 0x80)
+    {
+        out.push_back(char((zigzag & 0x7f) | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(char(zigzag));
+}
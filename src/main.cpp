@@ -85,6 +85,7 @@ extern "C" {
 #include <scan.hpp>
 #include <tag.hpp>
 #include <loudgain.hpp>
+#include <logger.hpp>
 
 #include <argparse.hpp>
 #include <taglib/taglib.h>
@@ -152,6 +153,10 @@ int main(int argc, char *argv[])
             .action([](const std::string& value) { return std::stod(value); })
             .help("Apply n dB/LU pre-gain value (-5 for -23 LUFS target).");
 
+    parser.add_argument("--targets", "-L").nargs(1)
+            .help("Also report gains for these reference levels in LUFS, each with an optional\n"
+                  "\t\t\t\ttrue peak ceiling in dBTP, e.g. -23,-14:-1,-16:-1 (no tags written).");
+
     parser.add_argument("--tagmode", "-S").nargs(1)
             .help("-S d: Delete ReplayGain tags from files\n"
                   "\t\t\t\t-S i: Write ReplayGain 2.0 tags to files\n"
@@ -173,6 +178,53 @@ int main(int argc, char *argv[])
             .action([](const std::string& value) { return std::stoi(value); })
             .help("Write ID3v2.3 or ID3v2.4 (default) tags to MP2/MP3/WAV/AIFF.");
 
+    parser.add_argument("--tag-padding", "-T").default_value(4096).nargs(1)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("Reserve n bytes of padding when tags must grow (MP2/MP3/FLAC/Ogg/MP4/WAV/AIFF).\n"
+                  "\t\t\t\tLater updates then fit without rewriting the file.");
+
+    parser.add_argument("--reflink", "-R").default_value(false).implicit_value(true)
+            .help("Write tags to a reflinked clone, then rename it over the file (btrfs, XFS).\n"
+                  "\t\t\t\tCrash-safe; files that can't be cloned are written in place.");
+
+    parser.add_argument("--defer-writes", "-W").default_value(false).implicit_value(true)
+            .help("Scan all files first, then write the tags in disk order, directory by directory.\n"
+                  "\t\t\t\tKeeps tag writes from competing with the scan's reads.");
+
+    parser.add_argument("--dry-run", "-n").default_value(false).implicit_value(true)
+            .help("Don't write tags, report per file and in total by format and device\n"
+                  "\t\t\t\twhich updates fit in place, which rewrite files, and how many bytes.");
+
+    parser.add_argument("--durability", "-D").default_value(std::string("none")).nargs(1)
+            .help("When written tags must be on disk: none (OS decides), fsync (per file),\n"
+                  "\t\t\t\tbatch (syncfs per album) or batch:n (syncfs per n files).");
+
+    parser.add_argument("--ordered", "-x").default_value(false).implicit_value(true)
+            .help("With -M, output results (-o, -O, -V 2) in input order, not as files finish.");
+
+    parser.add_argument("--log-format", "-g").default_value(std::string("text")).nargs(1)
+            .help("Messages as text (default) or json: one object per message, with\n"
+                  "\t\t\t\ttime, level and file index.");
+
+    parser.add_argument("--progress").default_value(0).nargs(1)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("Print files/s, MB/s, realtime factor and ETA to stderr every n seconds.");
+
+    parser.add_argument("--metrics").nargs(1)
+            .help("Keeps counters and latency histograms in this file (Prometheus text format),\n"
+                  "\t\t\t\tfor node_exporter's textfile collector.");
+
+    parser.add_argument("--metrics-interval").default_value(15).nargs(1)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("Seconds between updates of the --metrics file.");
+
+    parser.add_argument("--profile").default_value(false).implicit_value(true)
+            .help("Print the time spent per stage (open, decode, metering, tag writes...)\n"
+                  "\t\t\t\tand per-file latency percentiles, per format and codec.");
+
+    parser.add_argument("--trace").nargs(1)
+            .help("Writes a Chrome trace / Perfetto timeline of each worker's files and stages.");
+
     parser.add_argument("--multithread", "-M").default_value(0).nargs(1)
             .action([](const std::string& value) { return std::stoi(value); })
             .help("Enable multithreading, n = max number of threads.");
@@ -183,6 +235,21 @@ int main(int argc, char *argv[])
     parser.add_argument("--output-csv", "-O").nargs(1)
             .help("Writes comma separated values to file.");
 
+    parser.add_argument("--output-jsonl", "-J").nargs(1)
+            .help("Writes JSON Lines to file (- for stdout), one object per track and album.");
+
+    parser.add_argument("--output-binary", "-b").nargs(1)
+            .help("Writes a binary columnar result file, see loudgain-dump.");
+
+    parser.add_argument("--database", "-B").nargs(1)
+            .help("Stores track and album results in an SQLite database, one row per path,\n"
+                  "\t\t\t\twith size and content signature. With -S s, no file is written to.");
+
+    parser.add_argument("--curves", "-c").default_value(0).nargs(1)
+            .action([](const std::string& value) { return std::stoi(value); })
+            .help("With -B, also store momentary and short-term loudness every n ms\n"
+                  "\t\t\t\t(10 to 60000), measured in the same pass.");
+
     parser.add_argument("--recursive", "-r").default_value(false).implicit_value(true)
             .help("Recursive directory and file scan.");
 
@@ -260,12 +327,46 @@ int main(int argc, char *argv[])
     lg.setForceLowerCaseTags(parser.get<bool>("--lowercase"));  // force MP3 ID3v2 tags to lowercase
     lg.setStripTags(parser.get<bool>("--striptags"));           // MP3 ID3v2: strip other tag types
     lg.setID3v2Version(parser.get<int>("--id3v2version"));      // MP3 ID3v2 version to write; can be 3 or 4
+    lg.setTagPadding(parser.get<int>("--tag-padding"));         // reserve for in-place tag updates
+    lg.setReflink(parser.get<bool>("--reflink"));               // atomic tag updates via FICLONE
+    lg.setDurability(parser.get<std::string>("--durability"));  // none, fsync, batch[:n]
+    lg.setDeferWrites(parser.get<bool>("--defer-writes"));      // scan everything, then write
+    lg.setDryRun(parser.get<bool>("--dry-run"));                // plan tag writes, don't save
+    if (bool(parser.present("--targets")))
+        lg.setGainTargets(parser.get<std::string>("--targets"));   // before the CSV header
 
     lg.setTabOutput(parser.get<bool>("--output-tab"));
     if (bool(parser.present("--output-csv")))
         lg.openCsvFile(parser.get<std::string>("--output-csv"));
+    if (bool(parser.present("--database")))
+        lg.openResultStore(parser.get<std::string>("--database"));
+    lg.setCurveInterval(parser.get<int>("--curves"));
+    if (lg.curveInterval > 0 && !lg.resultStore.isOpen())
+    {
+        std::cerr << "Loudness curves (-c) are stored in the database, use -B." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (bool(parser.present("--output-binary")))
+        lg.openResultFile(parser.get<std::string>("--output-binary"));
 
     lg.setNumberOfThreads(parser.get<int>("--multithread"));
+    lg.setOrderedOutput(parser.get<bool>("--ordered"));         // after the CSV file is opened
+    lg.setProgress(parser.get<int>("--progress"));
+    lg.setProfile(parser.get<bool>("--profile"));
+    if (bool(parser.present("--trace")))
+        lg.openTrace(parser.get<std::string>("--trace"));
+    if (bool(parser.present("--metrics")))
+        lg.openMetrics(parser.get<std::string>("--metrics"), parser.get<int>("--metrics-interval"));
+    if (bool(parser.present("--output-jsonl")))
+        lg.openJsonLines(parser.get<std::string>("--output-jsonl"));
+
+    std::string log_format = parser.get<std::string>("--log-format");
+    if (log_format != "text" && log_format != "json")
+    {
+        std::cerr << "Invalid log format: " << log_format << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    Log::start(log_format == "json");
 
     auto t1 = std::chrono::high_resolution_clock::now();
 
@@ -288,8 +389,23 @@ int main(int argc, char *argv[])
         if (lg.verbosity > 0)
             std::cout << "Starting scan..." << std::endl;
         library.scanLibrary(lg);
+
+        if (lg.deferWrites && !lg.deferredWrites.empty())
+        {
+            if (lg.verbosity > 0)
+                Log(LOG_INFO) << "Writing tags...";     // after the scan's messages
+            lg.writeDeferredTags();
+        }
     }
+    lg.syncTagWrites();
+    lg.setOrderedOutput(false);     // writes what's still held back
     lg.closeCsvFile();
+    lg.closeResultStore();
+    lg.closeJsonLines();
+    lg.closeResultFile();
+    lg.closeTrace();
+    lg.closeMetrics();
+    Log::stop();    // the messages go before the summary
 
     auto t2 = std::chrono::high_resolution_clock::now();
 
@@ -297,6 +413,15 @@ int main(int argc, char *argv[])
 
     if (lg.verbosity > 0)
     {
+        if (lg.dryRun)
+            lg.printPlan();
+        else if (lg.tagMode != 's')
+        {
+            std::cout << "Tags already up to date in " << lg.tagsUnchanged << " file(s), skipped writing" << std::endl;
+            if (lg.tagsRewritten > 0)
+                std::cout << "Tags did not fit in " << lg.tagsRewritten << " file(s), files rewritten" << std::endl;
+        }
+
         if (duration < 60.0)
             std::cout << "Finished in " << duration << " seconds" << std::endl;
         else
@@ -304,6 +429,8 @@ int main(int argc, char *argv[])
             int du = int(round(duration));
             std::cout << "Finished in " << (du / 60) << "m:" << (du % 60) << "s" << std::endl;
         }
+
+        lg.profile.print();
     }
 
     return 0;
@@ -0,0 +1,252 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <time.h>
+#include <metrics.hpp>
+#include <logger.hpp>
+#include <scan.hpp>
+
+namespace fs = std::filesystem;
+
+// upper bounds in seconds, for open to decode of a file and for a save
+static const double bucketBounds[] = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0
+};
+
+void Metrics::Histogram::add(uint64_t ns)
+{
+    int i = 0;
+    while (i < BUCKETS - 1 && double(ns) / 1e9 > bucketBounds[i])
+        i++;
+
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+Metrics::~Metrics()
+{
+    close();
+}
+
+bool Metrics::open(const std::string &file, int seconds)
+{
+    if (isOpen())
+        return true;
+
+    path = file;
+    interval = std::max<int>(1, seconds);
+
+    // fail now rather than after hours of scanning
+    if (!write(true))
+    {
+        std::cerr << "Failed to write file: '" << path << "'" << std::endl;
+        path.clear();
+        return false;
+    }
+
+    stopping = false;
+    writer = std::thread(&Metrics::run, this);
+    return true;
+}
+
+void Metrics::close()
+{
+    if (!isOpen())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    if (!write(false))
+        std::cerr << "Couldn't write the metrics file" << std::endl;
+    path.clear();
+}
+
+void Metrics::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!wake.wait_for(lock, std::chrono::seconds(interval), [this] { return stopping; }))
+    {
+        if (!write(true))
+        {
+            Log(LOG_WARNING) << "Couldn't write the metrics file";
+        }
+    }
+}
+
+void Metrics::addScan(const AudioFile &audio_file, uint64_t ns)
+{
+    if (!isOpen())
+        return;
+
+    if (audio_file.scanStatus != AudioFile::SCANSTATUS::SUCCESS)
+    {
+        failed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    scanned.fetch_add(1, std::memory_order_relaxed);
+    bytesRead.fetch_add(audio_file.scannedBytes, std::memory_order_relaxed);
+    scanLatency.add(ns);
+
+    std::lock_guard<std::mutex> lock(codecMutex);
+    Codec &codec = codecs[avcodec_get_name(audio_file.avCodecId)];
+    codec.files++;
+    codec.audioSeconds += audio_file.scannedSeconds;
+    codec.decodeSeconds += double(audio_file.stageTimes[Profile::STAGE_DECODE]) / 1e9;
+}
+
+void Metrics::addTagWrite(const AudioFile &audio_file, uint64_t ns, bool ok)
+{
+    if (!isOpen())
+        return;
+
+    if (!ok)
+        tagFailures.fetch_add(1, std::memory_order_relaxed);
+    else if (audio_file.tagStatus == AudioFile::TAGSTATUS::UNCHANGED)
+        tagsUnchanged.fetch_add(1, std::memory_order_relaxed);
+    else
+    {
+        tagWrites.fetch_add(1, std::memory_order_relaxed);
+        if (audio_file.tagStatus == AudioFile::TAGSTATUS::REWRITTEN)
+            tagRewrites.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    tagLatency.add(ns);
+}
+
+static void counter(std::string &out, const char *name, const char *help, uint64_t value)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+             name, help, name, name, (unsigned long long) value);
+    out += buf;
+}
+
+static void histogram(std::string &out, const char *name, const char *help,
+                      const std::atomic<uint64_t> *buckets, int count, uint64_t sumNs)
+{
+    char buf[512];
+    uint64_t total = 0;
+
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += buf;
+
+    for (int i = 0; i < count; i++)
+    {
+        total += buckets[i].load(std::memory_order_relaxed);
+        if (i < count - 1)
+            snprintf(buf, sizeof(buf), "%s_bucket{le=\"%g\"} %llu\n", name, bucketBounds[i], (unsigned long long) total);
+        else
+            snprintf(buf, sizeof(buf), "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) total);
+        out += buf;
+    }
+
+    snprintf(buf, sizeof(buf), "%s_sum %.6f\n%s_count %llu\n", name, double(sumNs) / 1e9, name, (unsigned long long) total);
+    out += buf;
+}
+
+// the collector must never see half a file: write a temporary one next
+// to it (not *.prom, so it's ignored) and rename it over
+bool Metrics::write(bool running)
+{
+    std::string out;
+    char buf[512];
+
+    counter(out, "loudgain_files_scanned_total", "Files measured.", scanned.load());
+    counter(out, "loudgain_files_failed_total", "Files that couldn't be measured.", failed.load());
+    counter(out, "loudgain_files_skipped_total", "Files measured but not tagged, their format has no tag writer.", skipped.load());
+    counter(out, "loudgain_bytes_read_total", "Bytes read by the scans.", bytesRead.load());
+    counter(out, "loudgain_tag_writes_total", "Files whose tags were written.", tagWrites.load());
+    counter(out, "loudgain_tag_rewrites_total", "Tag writes that rewrote the whole file.", tagRewrites.load());
+    counter(out, "loudgain_tag_writes_unchanged_total",
+            "Tag saves skipped because the ReplayGain tags were already up to date.",
+            tagsUnchanged.load());
+    counter(out, "loudgain_tag_write_failures_total", "Tag writes that failed.", tagFailures.load());
+
+    {
+        std::lock_guard<std::mutex> lock(codecMutex);
+
+        out += "# HELP loudgain_audio_seconds_total Seconds of audio decoded.\n"
+               "# TYPE loudgain_audio_seconds_total counter\n";
+        for (const auto &entry : codecs)
+        {
+            snprintf(buf, sizeof(buf), "loudgain_audio_seconds_total{codec=\"%s\"} %.3f\n", entry.first.c_str(), entry.second.audioSeconds);
+            out += buf;
+        }
+
+        out += "# HELP loudgain_decode_seconds_total Thread time spent decoding.\n"
+               "# TYPE loudgain_decode_seconds_total counter\n";
+        for (const auto &entry : codecs)
+        {
+            snprintf(buf, sizeof(buf), "loudgain_decode_seconds_total{codec=\"%s\"} %.3f\n", entry.first.c_str(), entry.second.decodeSeconds);
+            out += buf;
+        }
+    }
+
+    histogram(out, "loudgain_scan_duration_seconds", "Time to measure a file, open to last query.",
+              scanLatency.buckets, BUCKETS, scanLatency.sumNs.load());
+    histogram(out, "loudgain_tag_write_duration_seconds", "Time to write a file's tags.",
+              tagLatency.buckets, BUCKETS, tagLatency.sumNs.load());
+
+    snprintf(buf, sizeof(buf),
+             "# HELP loudgain_running Whether the run is still going.\n# TYPE loudgain_running gauge\nloudgain_running %d\n"
+             "# HELP loudgain_last_update_timestamp_seconds When this file was written.\n"
+             "# TYPE loudgain_last_update_timestamp_seconds gauge\nloudgain_last_update_timestamp_seconds %lld\n",
+             running ? 1 : 0, (long long) time(NULL));
+    out += buf;
+
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    ok = fclose(file) == 0 && ok;
+
+    std::error_code ec;
+    if (ok)
+        fs::rename(temp, path, ec);
+    if (!ok || ec)
+    {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
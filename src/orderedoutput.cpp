@@ -0,0 +1,176 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <vector>
+#include <orderedoutput.hpp>
+#include <logger.hpp>
+
+OrderedOutput::~OrderedOutput()
+{
+    close();
+}
+
+void OrderedOutput::open(std::ostream *csv, size_t memoryLimit)
+{
+    this->csv = csv;
+    this->memoryLimit = memoryLimit;
+    next = 0;
+    buffered = 0;
+    opened = true;
+}
+
+// Writes what's left, in order, complete or not: an album that was never
+// processed mustn't hold back the rest.
+void OrderedOutput::close()
+{
+    if (!opened)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    flush(lock, true);
+    lock.unlock();
+
+    if (spillFile != NULL)
+        fclose(spillFile);
+    spillFile = NULL;
+    opened = false;
+}
+
+void OrderedOutput::add(int slot, STREAM stream, const std::string &text)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    slots[slot].text[stream] += text;
+    buffered += text.size();
+}
+
+void OrderedOutput::complete(int first, int count)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (int i = first; i < first + count; i++)
+        slots[i].done = true;
+
+    // held up: these wait on disk instead
+    if (first != next && buffered > memoryLimit)
+    {
+        for (int i = first; i < first + count; i++)
+            spill(slots[i]);
+    }
+
+    flush(lock, false);
+}
+
+void OrderedOutput::spill(Slot &slot)
+{
+    if (spillFile == NULL && (spillFile = tmpfile()) == NULL)
+        return;     // keep it in memory then
+
+    for (int s = 0; s < STREAMS; s++)
+    {
+        if (slot.text[s].empty())
+            continue;
+
+        if (fseek(spillFile, spillEnd, SEEK_SET) != 0 ||
+            fwrite(slot.text[s].data(), 1, slot.text[s].size(), spillFile) != slot.text[s].size())
+            continue;
+
+        slot.spilled[s] = spillEnd;
+        slot.length[s] = slot.text[s].size();
+        spillEnd += long(slot.length[s]);
+        buffered -= slot.length[s];
+        std::string().swap(slot.text[s]);
+    }
+}
+
+void OrderedOutput::unspill(Slot &slot)
+{
+    for (int s = 0; s < STREAMS; s++)
+    {
+        if (slot.spilled[s] < 0)
+            continue;
+
+        std::string text(slot.length[s], '\0');
+        if (fseek(spillFile, slot.spilled[s], SEEK_SET) != 0 ||
+            fread(&text[0], 1, text.size(), spillFile) != text.size())
+            Log(LOG_ERROR) << "Couldn't read back held up results";
+
+        slot.text[s] = std::move(text) + slot.text[s];
+        slot.spilled[s] = -1;
+        buffered += slot.length[s];     // back in memory, flush() takes it off again
+    }
+}
+
+void OrderedOutput::write(Slot &slot)
+{
+    if (!slot.text[STREAM_STDOUT].empty())
+        fwrite(slot.text[STREAM_STDOUT].data(), 1, slot.text[STREAM_STDOUT].size(), stdout);
+    if (!slot.text[STREAM_CSV].empty() && csv != NULL)
+        csv->write(slot.text[STREAM_CSV].data(), std::streamsize(slot.text[STREAM_CSV].size()));
+}
+
+// One thread writes at a time, the others leave their slots to it. The
+// writing itself is done without the lock.
+void OrderedOutput::flush(std::unique_lock<std::mutex> &lock, bool all)
+{
+    if (flushing)
+        return;
+    flushing = true;
+
+    std::vector<Slot> ready;
+
+    for (;;)
+    {
+        while (!slots.empty() && (all || (slots.begin()->first <= next && slots.begin()->second.done)))
+        {
+            auto it = slots.begin();
+            unspill(it->second);
+            for (const std::string &text : it->second.text)
+                buffered -= text.size();
+            next = it->first + 1;
+            ready.push_back(std::move(it->second));
+            slots.erase(it);
+        }
+
+        if (slots.empty())
+            spillEnd = 0;   // nothing on disk anymore, start over
+
+        if (ready.empty())
+            break;
+
+        lock.unlock();
+        for (Slot &slot : ready)
+            write(slot);
+        ready.clear();
+        fflush(stdout);
+        lock.lock();
+    }
+
+    flushing = false;
+}
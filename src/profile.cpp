@@ -0,0 +1,243 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <algorithm>
+#include <profile.hpp>
+#include <scan.hpp>
+#include <formats.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int LatencyHistogram::bucket(uint64_t us)
+{
+    if (us < uint64_t(SUB))
+        return int(us);
+
+    int e = 63;
+    while (!(us >> e))
+        e--;
+    return (e - SUB_BITS + 1) * SUB + int(us >> (e - SUB_BITS)) - SUB;
+}
+
+// the middle of the bucket
+uint64_t LatencyHistogram::value(int bucket)
+{
+    if (bucket < SUB)
+        return uint64_t(bucket);
+
+    int e = bucket / SUB + SUB_BITS - 1;
+    uint64_t lower = uint64_t(bucket % SUB + SUB) << (e - SUB_BITS);
+    return lower + (uint64_t(1) << (e - SUB_BITS)) / 2;
+}
+
+void LatencyHistogram::add(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+
+    if (counts.empty())
+        counts.resize(BUCKETS);
+    counts[bucket(us)]++;
+    total++;
+    maxUs = std::max(maxUs, us);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    if (other.counts.empty())
+        return;
+
+    if (counts.empty())
+        counts.resize(BUCKETS);
+    for (int i = 0; i < BUCKETS; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
+    maxUs = std::max(maxUs, other.maxUs);
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+    if (total == 0)
+        return 0.0;
+
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(p / 100.0 * double(total) + 0.5));
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return double(std::min(value(i), maxUs)) / 1000.0;
+    }
+    return max();
+}
+
+const char *Profile::stageName(STAGE stage)
+{
+    static const char *names[STAGE_COUNT] = {
+        "Open", "Info", "Demux", "Decode", "Resample", "Meter", "Query", "Tags"
+    };
+    return names[stage];
+}
+
+void Profile::start(int threads)
+{
+    tables = std::vector<Table>(std::max<int>(1, threads));
+}
+
+Profile::Table &Profile::table()
+{
+#ifdef _OPENMP
+    return tables[size_t(omp_get_thread_num()) % tables.size()];
+#else
+    return tables[0];
+#endif
+}
+
+static std::string profile_key(const AudioFile &audio_file)
+{
+    return std::string(audio_file.format != NULL ? audio_file.format->name : audio_file.avFormat.c_str()) +
+           "/" + avcodec_get_name(audio_file.avCodecId);
+}
+
+void Profile::addScan(const AudioFile &audio_file)
+{
+    if (!isOn())
+        return;
+
+    const uint64_t *ns = audio_file.stageTimes;
+    Totals &totals = table().totals[profile_key(audio_file)];
+
+    totals.files++;
+    for (int i = 0; i < STAGE_TAG_WRITE; i++)
+        totals.ns[i] += ns[i];
+
+    // a file that failed to open has no decode time
+    totals.latency[LATENCY_OPEN].add(ns[STAGE_OPEN] + ns[STAGE_STREAM_INFO]);
+    uint64_t decode = ns[STAGE_DEMUX] + ns[STAGE_DECODE] + ns[STAGE_RESAMPLE] + ns[STAGE_METER];
+    if (decode > 0)
+        totals.latency[LATENCY_DECODE].add(decode);
+}
+
+void Profile::addTagWrite(const AudioFile &audio_file, uint64_t ns)
+{
+    if (!isOn())
+        return;
+
+    Totals &totals = table().totals[profile_key(audio_file)];
+
+    totals.tagWrites++;
+    totals.ns[STAGE_TAG_WRITE] += ns;
+    totals.latency[LATENCY_TAG_WRITE].add(ns);
+}
+
+// after the workers are done
+void Profile::print()
+{
+    if (!isOn())
+        return;
+
+    std::map<std::string, Totals> merged;
+    Totals sum;
+
+    for (const Table &t : tables)
+    {
+        for (const auto &entry : t.totals)
+        {
+            Totals &totals = merged[entry.first];
+            totals.files += entry.second.files;
+            totals.tagWrites += entry.second.tagWrites;
+            sum.files += entry.second.files;
+            sum.tagWrites += entry.second.tagWrites;
+            for (int i = 0; i < STAGE_COUNT; i++)
+            {
+                totals.ns[i] += entry.second.ns[i];
+                sum.ns[i] += entry.second.ns[i];
+            }
+            for (int i = 0; i < LATENCY_COUNT; i++)
+                totals.latency[i].merge(entry.second.latency[i]);
+        }
+    }
+
+    if (merged.empty())
+        return;
+
+    auto row = [](const std::string &name, const Totals &totals) {
+        printf("%-20s %7lld", name.c_str(), totals.files);
+        for (int i = 0; i < STAGE_COUNT; i++)
+            printf(" %9.2f", double(totals.ns[i]) / 1e9);
+        printf("\n");
+    };
+
+    uint64_t all = 0;
+    for (int i = 0; i < STAGE_COUNT; i++)
+        all += sum.ns[i];
+
+    printf("Profile, thread time in seconds:\n%-20s %7s", "Format/codec", "Files");
+    for (int i = 0; i < STAGE_COUNT; i++)
+        printf(" %9s", stageName(STAGE(i)));
+    printf("\n");
+
+    for (const auto &entry : merged)
+        row(entry.first, entry.second);
+    if (merged.size() > 1)
+        row("Total", sum);
+
+    printf("%-20s %7s", "Share", "");
+    for (int i = 0; i < STAGE_COUNT; i++)
+        printf(" %8.1f%%", all > 0 ? 100.0 * double(sum.ns[i]) / double(all) : 0.0);
+    printf("\n");
+
+    printLatency(merged);
+}
+
+// the tail, per format and codec
+void Profile::printLatency(const std::map<std::string, Totals> &merged)
+{
+    static const char *names[LATENCY_COUNT] = { "Open", "Decode", "Tags" };
+
+    printf("Latency per file in ms:\n%-20s %-7s %7s %9s %9s %9s %9s\n",
+           "Format/codec", "Stage", "Files", "p50", "p99", "p99.9", "Max");
+
+    for (const auto &entry : merged)
+    {
+        for (int i = 0; i < LATENCY_COUNT; i++)
+        {
+            const LatencyHistogram &h = entry.second.latency[i];
+            if (h.count() == 0)
+                continue;
+
+            printf("%-20s %-7s %7llu %9.2f %9.2f %9.2f %9.2f\n", entry.first.c_str(), names[i],
+                   (unsigned long long) h.count(), h.percentile(50.0), h.percentile(99.0),
+                   h.percentile(99.9), h.max());
+        }
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <filesystem>
+#include <progress.hpp>
+#include <scan.hpp>
+
+namespace fs = std::filesystem;
+
+Progress::~Progress()
+{
+    stop();
+}
+
+// the sizes are taken once, from the discovered files
+void Progress::start(const std::vector<std::string> &paths, int seconds)
+{
+    if (reporter.joinable() || seconds <= 0)
+        return;
+
+    totalFiles = (long long) paths.size();
+    totalBytes = 0;
+    for (const std::string &path : paths)
+    {
+        std::error_code ec;
+        uintmax_t size = fs::file_size(path, ec);
+        if (!ec)
+            totalBytes += size;
+    }
+
+    files = albums = 0;
+    bytes = audioMs = 0;
+    interval = seconds;
+    stopping = false;
+    started = std::chrono::steady_clock::now();
+    reporter = std::thread(&Progress::run, this);
+}
+
+void Progress::fileDone(const AudioFile &audio_file)
+{
+    if (!reporter.joinable())
+        return;
+
+    files.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(audio_file.scannedBytes, std::memory_order_relaxed);
+    audioMs.fetch_add(uint64_t(audio_file.scannedSeconds * 1000.0), std::memory_order_relaxed);
+}
+
+void Progress::stop()
+{
+    if (!reporter.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    reporter.join();
+}
+
+void Progress::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!wake.wait_for(lock, std::chrono::seconds(interval), [this] { return stopping; }))
+        report();
+}
+
+static std::string format_duration(double seconds)
+{
+    char buf[32];
+    long s = long(seconds + 0.5);
+
+    if (s >= 3600)
+        snprintf(buf, sizeof(buf), "%ldh%02ldm", s / 3600, (s / 60) % 60);
+    else
+        snprintf(buf, sizeof(buf), "%ldm%02lds", s / 60, s % 60);
+    return buf;
+}
+
+// rates are averages since the start, the ETA is the remaining bytes at
+// that rate (files, if nothing is decoded, -S d)
+void Progress::report()
+{
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    long long done = files.load(std::memory_order_relaxed);
+    uint64_t read = bytes.load(std::memory_order_relaxed);
+    double audio = double(audioMs.load(std::memory_order_relaxed)) / 1000.0;
+
+    if (elapsed <= 0.0)
+        return;
+
+    double rate = double(read) / elapsed;
+    std::string eta = "-";
+    if (rate > 0.0 && totalBytes > read)
+        eta = format_duration(double(totalBytes - read) / rate);
+    else if (read == 0 && done > 0 && totalFiles > done)
+        eta = format_duration(double(totalFiles - done) * elapsed / double(done));
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "Progress: %lld/%lld files, %lld albums, %.1f/%.1f GB, %.1f files/s, %.1f MB/s, %.0fx realtime, ETA %s\n",
+             done, totalFiles, albums.load(std::memory_order_relaxed),
+             double(read) / 1e9, double(totalBytes) / 1e9,
+             double(done) / elapsed, rate / 1e6, audio / elapsed, eta.c_str());
+    fputs(line, stderr);
+}
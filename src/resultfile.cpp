@@ -0,0 +1,203 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <logger.hpp>
+#include <string.h>
+#include <math.h>
+#include <resultfile.hpp>
+#include <formats.hpp>
+
+ResultFile::~ResultFile()
+{
+    close();
+}
+
+bool ResultFile::open(const std::string &path)
+{
+    if (file != NULL)
+        return true;
+
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        std::cerr << "Failed to open file: '" << path << "'" << std::endl;
+        return false;
+    }
+
+    ResultFileHeader header;
+    memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+    header.version = RESULT_FILE_VERSION;
+    header.order = RESULT_FILE_ORDER;
+    fwrite(&header, sizeof(header), 1, file);
+
+    block.clear();
+    failed = false;
+    return true;
+}
+
+void ResultFile::close()
+{
+    if (file == NULL)
+        return;
+
+    if (block.rows() > 0)
+        write(block);
+
+    if (fclose(file) != 0 && !failed)
+        std::cerr << "Couldn't write the binary result file" << std::endl;
+    file = NULL;
+}
+
+uint16_t ResultFile::Block::intern(const std::string &s)
+{
+    auto it = names.find(s);
+    if (it != names.end())
+        return it->second;
+
+    uint16_t index = uint16_t(names.size());
+    names.emplace(s, index);
+    nameStrings += s;
+    name.push_back(uint32_t(nameStrings.size()));
+    return index;
+}
+
+void ResultFile::Block::clear()
+{
+    for (std::vector<double> &column : doubles)
+        column.clear();
+    path.assign(1, 0);
+    name.assign(1, 0);
+    format.clear();
+    codec.clear();
+    flags.clear();
+    codecId.clear();
+    paths.clear();
+    nameStrings.clear();
+    names.clear();
+}
+
+void ResultFile::add(const std::string &path, const std::string &format, AVCodecID codecId,
+                     uint16_t flags, const double (&values)[ResultBlockLayout::DOUBLES])
+{
+    const char *codec = codecId != AV_CODEC_ID_NONE ? avcodec_get_name(codecId) : "";
+    Block full;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (int i = 0; i < ResultBlockLayout::DOUBLES; i++)
+            block.doubles[i].push_back(values[i]);
+        block.paths += path;
+        block.path.push_back(uint32_t(block.paths.size()));
+        block.format.push_back(block.intern(format));
+        block.codec.push_back(block.intern(codec));
+        block.flags.push_back(flags);
+        block.codecId.push_back(int32_t(codecId));
+
+        // string offsets are 32 bit
+        if (block.rows() < RESULT_BLOCK_ROWS && block.paths.size() < 0x40000000)
+            return;
+
+        std::swap(full, block);
+        block.clear();
+    }
+
+    write(full);
+}
+
+void ResultFile::write(Block &b)
+{
+    ResultBlockHeader header;
+    memcpy(header.magic, RESULT_BLOCK_MAGIC, sizeof(header.magic));
+    header.rows = b.rows();
+    header.names = uint32_t(b.names.size());
+    header.stringBytes = uint32_t(b.nameStrings.size() + b.paths.size());
+
+    ResultBlockLayout layout(header.rows, header.names, header.stringBytes);
+    std::vector<char> data(layout.size, 0);
+
+    for (uint32_t &offset : b.path)
+        offset += uint32_t(b.nameStrings.size());
+
+    memcpy(data.data(), &header, sizeof(header));
+    for (int i = 0; i < ResultBlockLayout::DOUBLES; i++)
+        memcpy(data.data() + layout.doubles[i], b.doubles[i].data(), header.rows * sizeof(double));
+    memcpy(data.data() + layout.path, b.path.data(), b.path.size() * sizeof(uint32_t));
+    memcpy(data.data() + layout.name, b.name.data(), b.name.size() * sizeof(uint32_t));
+    memcpy(data.data() + layout.format, b.format.data(), header.rows * sizeof(uint16_t));
+    memcpy(data.data() + layout.codec, b.codec.data(), header.rows * sizeof(uint16_t));
+    memcpy(data.data() + layout.flags, b.flags.data(), header.rows * sizeof(uint16_t));
+    memcpy(data.data() + layout.codecId, b.codecId.data(), header.rows * sizeof(int32_t));
+    memcpy(data.data() + layout.strings, b.nameStrings.data(), b.nameStrings.size());
+    memcpy(data.data() + layout.strings + b.nameStrings.size(), b.paths.data(), b.paths.size());
+
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (fwrite(data.data(), 1, data.size(), file) != data.size() && !failed)
+    {
+        failed = true;
+        Log(LOG_ERROR) << "Couldn't write the binary result file";
+    }
+}
+
+void ResultFile::addTrack(const AudioFile &audio_file, bool album)
+{
+    if (!isOpen())
+        return;
+
+    const double values[ResultBlockLayout::DOUBLES] = {
+        audio_file.trackLoudness, audio_file.trackLoudnessRange, audio_file.trackPeak,
+        audio_file.loudnessReference, audio_file.trackGain, audio_file.newTrackPeak,
+        album ? audio_file.albumLoudness : NAN, album ? audio_file.albumLoudnessRange : NAN,
+        album ? audio_file.albumPeak : NAN, album ? audio_file.albumGain : NAN
+    };
+    uint16_t flags = (album ? RESULT_HAS_ALBUM : 0)
+                   | ((audio_file.trackClips || audio_file.albumClips) ? RESULT_CLIPS : 0)
+                   | (audio_file.clipPrevention ? RESULT_CLIP_PREVENTION : 0);
+
+    add(audio_file.filePath, audio_file.format != NULL ? audio_file.format->name : audio_file.avFormat,
+        audio_file.avCodecId, flags, values);
+}
+
+void ResultFile::addAlbum(const AudioFile &audio_file)
+{
+    if (!isOpen())
+        return;
+
+    const double values[ResultBlockLayout::DOUBLES] = {
+        audio_file.albumLoudness, audio_file.albumLoudnessRange, audio_file.albumPeak,
+        audio_file.loudnessReference, audio_file.albumGain, audio_file.newAlbumPeak,
+        NAN, NAN, NAN, NAN
+    };
+    uint16_t flags = RESULT_ALBUM
+                   | (audio_file.albumClips ? RESULT_CLIPS : 0)
+                   | (audio_file.clipPrevention ? RESULT_CLIP_PREVENTION : 0);
+
+    add(audio_file.directory, "", AV_CODEC_ID_NONE, flags, values);
+}
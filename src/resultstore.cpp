@@ -0,0 +1,395 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <logger.hpp>
+#include <chrono>
+#include <resultstore.hpp>
+#include <fileio.hpp>
+#include <formats.hpp>
+
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+
+// records per transaction; a partial batch is committed after a second
+static const size_t batchSize = 4096;
+
+ResultStore::~ResultStore()
+{
+    close();
+}
+
+#ifdef HAVE_SQLITE3
+
+static const char *schema =
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "CREATE TABLE IF NOT EXISTS tracks ("  // one row per file, as last measured
+    " path TEXT PRIMARY KEY,"
+    " size INTEGER NOT NULL,"           // size and signature tell if it changed since
+    " signature INTEGER NOT NULL,"      // FNV-1a of the first and last 64 KiB
+    " directory TEXT,"
+    " format TEXT,"
+    " codec TEXT,"
+    " loudness REAL,"
+    " loudness_range REAL,"
+    " peak REAL,"
+    " reference REAL,"
+    " gain REAL,"
+    " new_peak REAL,"
+    " clips INTEGER,"
+    " clip_prevention INTEGER,"
+    " album_loudness REAL,"
+    " album_loudness_range REAL,"
+    " album_peak REAL,"
+    " album_gain REAL,"
+    " scanned INTEGER NOT NULL DEFAULT (strftime('%s', 'now')));"
+    "CREATE TABLE IF NOT EXISTS albums ("
+    " directory TEXT PRIMARY KEY,"
+    " loudness REAL,"
+    " loudness_range REAL,"
+    " peak REAL,"
+    " reference REAL,"
+    " gain REAL,"
+    " new_peak REAL,"
+    " clips INTEGER,"
+    " clip_prevention INTEGER,"
+    " scanned INTEGER NOT NULL DEFAULT (strftime('%s', 'now')));"
+    "CREATE TABLE IF NOT EXISTS curves ("  // see loudnesscurve.hpp for the encoding
+    " path TEXT PRIMARY KEY,"
+    " size INTEGER NOT NULL,"
+    " signature INTEGER NOT NULL,"
+    " interval_ms INTEGER NOT NULL,"
+    " points INTEGER NOT NULL,"
+    " momentary BLOB,"
+    " short_term BLOB);"
+    "CREATE TABLE IF NOT EXISTS targets ("  // --targets
+    " path TEXT NOT NULL,"
+    " size INTEGER NOT NULL,"
+    " signature INTEGER NOT NULL,"
+    " reference REAL NOT NULL,"
+    " gain REAL,"
+    " new_peak REAL,"
+    " limited INTEGER,"
+    " album_gain REAL,"
+    " album_new_peak REAL,"
+    " album_limited INTEGER,"
+    " PRIMARY KEY (path, reference));";
+
+bool ResultStore::open(const std::string &path)
+{
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK ||
+        sqlite3_exec(db, schema, NULL, NULL, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "INSERT OR REPLACE INTO tracks (path, size, signature, directory, format, codec,"
+            " loudness, loudness_range, peak, reference, gain, new_peak, clips, clip_prevention,"
+            " album_loudness, album_loudness_range, album_peak, album_gain)"
+            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+            -1, &insertTrack, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "INSERT OR REPLACE INTO albums (directory, loudness, loudness_range, peak, reference,"
+            " gain, new_peak, clips, clip_prevention)"
+            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+            -1, &insertAlbum, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "INSERT OR REPLACE INTO curves (path, size, signature, interval_ms, points, momentary, short_term)"
+            " VALUES (?, ?, ?, ?, ?, ?, ?)",
+            -1, &insertCurve, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "INSERT OR REPLACE INTO targets (path, size, signature, reference, gain, new_peak, limited,"
+            " album_gain, album_new_peak, album_limited)"
+            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+            -1, &insertTarget, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "DELETE FROM curves WHERE path = ?", -1, &deleteCurve, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "DELETE FROM targets WHERE path = ?", -1, &deleteTargets, NULL) != SQLITE_OK)
+    {
+        std::cerr << "Failed to open database: '" << path << "' (" << sqlite3_errmsg(db) << ")" << std::endl;
+        sqlite3_finalize(insertTrack);
+        sqlite3_finalize(insertAlbum);
+        sqlite3_finalize(insertCurve);
+        sqlite3_finalize(insertTarget);
+        sqlite3_finalize(deleteCurve);
+        sqlite3_finalize(deleteTargets);
+        sqlite3_close(db);
+        insertTrack = insertAlbum = insertCurve = insertTarget = deleteCurve = deleteTargets = NULL;
+        db = NULL;
+        return false;
+    }
+
+    stopping = false;
+    writer = std::thread(&ResultStore::run, this);
+    return true;
+}
+
+void ResultStore::close()
+{
+    if (db == NULL)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    sqlite3_finalize(insertTrack);
+    sqlite3_finalize(insertAlbum);
+    sqlite3_finalize(insertCurve);
+    sqlite3_finalize(insertTarget);
+    sqlite3_finalize(deleteCurve);
+    sqlite3_finalize(deleteTargets);
+    sqlite3_close(db);
+    insertTrack = insertAlbum = insertCurve = insertTarget = deleteCurve = deleteTargets = NULL;
+    db = NULL;
+}
+
+void ResultStore::run()
+{
+    std::vector<Record> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;)
+    {
+        wake.wait_for(lock, std::chrono::seconds(1), [this] {
+            return stopping || pending.size() >= batchSize;
+        });
+
+        bool last = stopping;
+        batch.swap(pending);
+        lock.unlock();
+
+        if (!batch.empty() && !failed && !commit(batch))
+        {
+            failed = true;
+            Log(LOG_ERROR) << "Couldn't write results to the database (" << sqlite3_errmsg(db) << ")";
+        }
+        batch.clear();
+
+        lock.lock();
+        if (last && pending.empty())
+            break;
+    }
+}
+
+bool ResultStore::commit(const std::vector<Record> &batch)
+{
+    if (sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+        return false;
+
+    for (const Record &r : batch)
+    {
+        sqlite3_stmt *s = r.album ? insertAlbum : insertTrack;
+        int i = 1;
+
+        if (!r.album)
+        {
+            sqlite3_bind_text(s, i++, r.path.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(s, i++, sqlite3_int64(r.size));
+            sqlite3_bind_int64(s, i++, sqlite3_int64(r.signature));
+            sqlite3_bind_text(s, i++, r.directory.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(s, i++, r.format.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(s, i++, r.codec.c_str(), -1, SQLITE_STATIC);
+        }
+        else
+            sqlite3_bind_text(s, i++, r.path.c_str(), -1, SQLITE_STATIC);
+
+        sqlite3_bind_double(s, i++, r.loudness);
+        sqlite3_bind_double(s, i++, r.range);
+        sqlite3_bind_double(s, i++, r.peak);
+        sqlite3_bind_double(s, i++, r.reference);
+        sqlite3_bind_double(s, i++, r.gain);
+        sqlite3_bind_double(s, i++, r.newPeak);
+        sqlite3_bind_int(s, i++, r.clips);
+        sqlite3_bind_int(s, i++, r.clipPrevention);
+
+        if (!r.album)
+        {
+            for (double value : {r.albumLoudness, r.albumRange, r.albumPeak, r.albumGain})
+            {
+                if (r.hasAlbum)
+                    sqlite3_bind_double(s, i++, value);
+                else
+                    sqlite3_bind_null(s, i++);
+            }
+        }
+
+        int rc = sqlite3_step(s);
+        sqlite3_reset(s);
+
+        // what an earlier run stored for the file is replaced as a whole
+        for (sqlite3_stmt *d : {deleteCurve, deleteTargets})
+        {
+            if (r.album || rc != SQLITE_DONE)
+                break;
+            sqlite3_bind_text(d, 1, r.path.c_str(), -1, SQLITE_STATIC);
+            rc = sqlite3_step(d);
+            sqlite3_reset(d);
+        }
+
+        if (rc == SQLITE_DONE && r.curvePoints > 0)
+        {
+            s = insertCurve;
+            sqlite3_bind_text(s, 1, r.path.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(s, 2, sqlite3_int64(r.size));
+            sqlite3_bind_int64(s, 3, sqlite3_int64(r.signature));
+            sqlite3_bind_int(s, 4, r.curveInterval);
+            sqlite3_bind_int64(s, 5, r.curvePoints);
+            sqlite3_bind_blob(s, 6, r.momentary.data(), int(r.momentary.size()), SQLITE_STATIC);
+            sqlite3_bind_blob(s, 7, r.shortTerm.data(), int(r.shortTerm.size()), SQLITE_STATIC);
+            rc = sqlite3_step(s);
+            sqlite3_reset(s);
+        }
+
+        for (const TargetGain &gain : r.targets)
+        {
+            if (rc != SQLITE_DONE)
+                break;
+
+            s = insertTarget;
+            sqlite3_bind_text(s, 1, r.path.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(s, 2, sqlite3_int64(r.size));
+            sqlite3_bind_int64(s, 3, sqlite3_int64(r.signature));
+            sqlite3_bind_double(s, 4, gain.reference);
+            sqlite3_bind_double(s, 5, gain.trackGain);
+            sqlite3_bind_double(s, 6, gain.newTrackPeak);
+            sqlite3_bind_int(s, 7, gain.trackLimited);
+            if (r.hasAlbum)
+            {
+                sqlite3_bind_double(s, 8, gain.albumGain);
+                sqlite3_bind_double(s, 9, gain.newAlbumPeak);
+                sqlite3_bind_int(s, 10, gain.albumLimited);
+            }
+            else
+            {
+                sqlite3_bind_null(s, 8);
+                sqlite3_bind_null(s, 9);
+                sqlite3_bind_null(s, 10);
+            }
+            rc = sqlite3_step(s);
+            sqlite3_reset(s);
+        }
+
+        if (rc != SQLITE_DONE)
+        {
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+            return false;
+        }
+    }
+
+    return sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK;
+}
+
+#else
+
+bool ResultStore::open(const std::string &path)
+{
+    std::cerr << "Can't write '" << path << "': built without SQLite support" << std::endl;
+    return false;
+}
+
+void ResultStore::close()
+{ }
+
+#endif
+
+void ResultStore::queue(Record &&record)
+{
+    bool full;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(record));
+        full = pending.size() >= batchSize;
+    }
+
+    if (full)
+        wake.notify_one();
+}
+
+// The signature is taken here, by the worker, while the file is still cached.
+// It covers the tags, so callers add a track only once its tags are saved
+// (deferred writes: in LoudGain::writeDeferredTags). The loudness curve
+// moves into the record, the AudioFile needn't hold on to it.
+void ResultStore::addTrack(AudioFile &audio_file, bool album)
+{
+    if (!isOpen())
+        return;
+
+    Record r;
+    r.album = false;
+    r.path = audio_file.filePath;
+    r.directory = audio_file.directory;
+    r.format = audio_file.format != NULL ? audio_file.format->name : audio_file.avFormat;
+    r.codec = avcodec_get_name(audio_file.avCodecId);
+    if (!file_signature(audio_file.filePath, r.size, r.signature))
+        r.size = r.signature = 0;
+    r.loudness = audio_file.trackLoudness;
+    r.range = audio_file.trackLoudnessRange;
+    r.peak = audio_file.trackPeak;
+    r.reference = audio_file.loudnessReference;
+    r.gain = audio_file.trackGain;
+    r.newPeak = audio_file.newTrackPeak;
+    r.clips = audio_file.trackClips || audio_file.albumClips;
+    r.clipPrevention = audio_file.clipPrevention;
+    r.hasAlbum = album;
+    r.albumLoudness = audio_file.albumLoudness;
+    r.albumRange = audio_file.albumLoudnessRange;
+    r.albumPeak = audio_file.albumPeak;
+    r.albumGain = audio_file.albumGain;
+    r.targets = audio_file.targetGains;
+    r.curveInterval = audio_file.curve.interval;
+    r.curvePoints = audio_file.curve.points;
+    r.momentary.swap(audio_file.curve.momentary);
+    r.shortTerm.swap(audio_file.curve.shortTerm);
+    audio_file.curve.clear();
+
+    queue(std::move(r));
+}
+
+void ResultStore::addAlbum(const AudioFile &audio_file)
+{
+    if (!isOpen())
+        return;
+
+    Record r = Record();
+    r.album = true;
+    r.path = audio_file.directory;
+    r.loudness = audio_file.albumLoudness;
+    r.range = audio_file.albumLoudnessRange;
+    r.peak = audio_file.albumPeak;
+    r.reference = audio_file.loudnessReference;
+    r.gain = audio_file.albumGain;
+    r.newPeak = audio_file.newAlbumPeak;
+    r.clips = audio_file.albumClips;
+    r.clipPrevention = audio_file.clipPrevention;
+
+    queue(std::move(r));
+}
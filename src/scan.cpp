@@ -40,7 +40,12 @@
 #include <omp.h>
 #include <loudgain.hpp>
 #include <scan.hpp>
+#include <formats.hpp>
+#include <logger.hpp>
 #include <math.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 
 #define LUFS_TO_RG(L) (-18 - L)
 #define UNUSED(x) (void)x
@@ -61,6 +66,7 @@ AudioFile::AudioFile(const std::string &path)
 {
     fs::path p(path);
     filePath = p.u8string();
+    tagPath = filePath;
     fileName = p.filename().u8string();
     directory = p.parent_path().u8string();
 }
@@ -82,28 +88,205 @@ bool AudioFile::destroyEbuR128State()
     return false;
 }
 
+bool AudioFile::openFile()
+{
+    if (!fileHandle)
+        fileHandle.reset(new FileHandle(filePath, writeInPlace));
+    return fileHandle->isOpen();
+}
+
+void AudioFile::closeFile()
+{
+    fileHandle.reset();
+}
+
+// album tracks whose handles are kept from the scan to the tag write
+static const int maxOpenTracks = 64;
+
+// FFmpeg reads through our FileHandle, see AudioFile::fileHandle
+static int scan_avio_read(void *opaque, uint8_t *buf, int size)
+{
+    long n = static_cast<FileHandle *>(opaque)->read(buf, size);
+    if (n < 0)
+        return AVERROR(errno);
+    return n == 0 ? AVERROR_EOF : int(n);
+}
+
+static int64_t scan_avio_seek(void *opaque, int64_t offset, int whence)
+{
+    FileHandle *handle = static_cast<FileHandle *>(opaque);
+
+    if (whence & AVSEEK_SIZE)
+        return handle->size();
+
+    int64_t pos = handle->seek(offset, whence & ~AVSEEK_FORCE);
+    return pos < 0 ? AVERROR(errno) : pos;
+}
+
+// avformat_close_input() leaves a custom AVIOContext to its owner
+static void scan_avio_free(AVIOContext *avio)
+{
+    if (avio != NULL)
+    {
+        av_freep(&avio->buffer);
+        avio_context_free(&avio);
+    }
+}
+
+// Just enough of the file header to pick the tag writer: sets avFormat to
+// the demuxer name FFmpeg would report, and avCodecId for Ogg. Returns
+// false if the format isn't obvious; scanFile() has to probe then.
+bool AudioFile::probeFile(bool verbose)
+{
+    unsigned char h[12];
+
+    auto readAt = [this](int64_t offset, unsigned char *buf, long size) {
+        return fileHandle->seek(offset, SEEK_SET) == offset &&
+               fileHandle->read(buf, size) == size;
+    };
+
+    if (!openFile() || !readAt(0, h, 12))
+        return false;
+
+    std::string format;
+    AVCodecID codec = AV_CODEC_ID_NONE;
+    int64_t offset = 0;
+
+    // ID3v2 in front of MP3 (or FLAC): look behind it
+    if (memcmp(h, "ID3", 3) == 0)
+    {
+        offset = 10 + ((h[6] & 0x7f) << 21 | (h[7] & 0x7f) << 14 | (h[8] & 0x7f) << 7 | (h[9] & 0x7f));
+        if (h[5] & 0x10)
+            offset += 10;   // footer
+        if (!readAt(offset, h, 4))
+            return false;
+    }
+
+    if (memcmp(h, "fLaC", 4) == 0)
+        format = "flac";
+    else if (h[0] == 0xff && (h[1] & 0xe0) == 0xe0 && (h[1] & 0x06) != 0)
+        format = "mp3";     // MPEG audio frame sync, layer I-III (not ADTS AAC)
+    else if (offset != 0)
+        return false;
+    else if (memcmp(h, "OggS", 4) == 0)
+    {
+        // the first packet of the first page identifies the codec
+        unsigned char page[27 + 255];
+        if (!readAt(0, page, 27) || !readAt(27, page + 27, page[26]))
+            return false;
+        unsigned char packet[8];
+        if (!readAt(27 + page[26], packet, 8))
+            return false;
+
+        if (memcmp(packet, "OpusHead", 8) == 0)
+            codec = AV_CODEC_ID_OPUS;
+        else if (memcmp(packet, "\x01vorbis", 7) == 0)
+            codec = AV_CODEC_ID_VORBIS;
+        else if (memcmp(packet, "\x7f" "FLAC", 5) == 0)
+            codec = AV_CODEC_ID_FLAC;
+        else if (memcmp(packet, "Speex   ", 8) == 0)
+            codec = AV_CODEC_ID_SPEEX;
+        else
+            return false;
+        format = "ogg";
+    }
+    else if (memcmp(h + 4, "ftyp", 4) == 0 || memcmp(h + 4, "moov", 4) == 0)
+        format = "mov,mp4,m4a,3gp,3g2,mj2";
+    else if (memcmp(h, "\x30\x26\xb2\x75\x8e\x66\xcf\x11", 8) == 0)
+        format = "asf";
+    else if (memcmp(h, "RIFF", 4) == 0 && memcmp(h + 8, "WAVE", 4) == 0)
+        format = "wav";
+    else if (memcmp(h, "FORM", 4) == 0 && (memcmp(h + 8, "AIFF", 4) == 0 || memcmp(h + 8, "AIFC", 4) == 0))
+        format = "aiff";
+    else if (memcmp(h, "wvpk", 4) == 0)
+        format = "wv";
+    else if (memcmp(h, "MAC ", 4) == 0)
+        format = "ape";
+    else
+        return false;
+
+    avFormat = format;
+    avCodecId = codec;
+    this->format = format_find(avFormat.c_str(), avCodecId);
+
+    if (verbose)
+    {
+        Log(LOG_INFO, fileId) << "[" << fileName << "] " << "Container: [" << avFormat << "] (from file header)";
+    }
+
+    return true;
+}
+
+// with --profile: the time since the last lap goes to `stage`
+void AudioFile::lap(Profile::STAGE stage)
+{
+    if (!profile)
+        return;
+
+    uint64_t now = Profile::now();
+    stageTimes[stage] += now - lapStart;
+    lapStart = now;
+}
+
+// with --trace: the time since the last mark is the scan's phase `name`
+void AudioFile::mark(const char *name, std::string args)
+{
+    if (trace == NULL)
+        return;
+
+    uint64_t now = Profile::now();
+    trace->add(name, fileId, markStart, now, std::move(args));
+    markStart = now;
+}
+
 bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
 {
     scanStatus = SCANSTATUS::PROCESSING;
+    if (profile || trace != NULL)
+        lapStart = markStart = Profile::now();
 
+    // the descriptor is kept only if the tags are saved through it, see
+    // LoudGain::writesInPlace; released after the AVIOContext below
+    std::unique_ptr<AudioFile, void (*)(AudioFile *)> release(writeInPlace ? NULL : this,
+                                                              [](AudioFile *f) { f->closeFile(); });
     AVFormatContext *container = NULL;
+    std::unique_ptr<AVIOContext, void (*)(AVIOContext *)> avio(NULL, scan_avio_free);
+
+    // read through our own descriptor, the tag writers reuse it later
+    if (openFile() && fileHandle->seek(0, SEEK_SET) == 0)
+    {
+        const int bufsize = 64 * 1024;
+        unsigned char *buffer = static_cast<unsigned char *>(av_malloc(bufsize));
+        if (buffer != NULL)
+            avio.reset(avio_alloc_context(buffer, bufsize, 0, fileHandle.get(), scan_avio_read, NULL, scan_avio_seek));
+        if (avio)
+            container = avformat_alloc_context();
+        if (container != NULL)
+        {
+            container->pb = avio.get();
+            container->flags |= AVFMT_FLAG_CUSTOM_IO;
+        }
+        else if (buffer != NULL && !avio)
+            av_free(buffer);
+    }
+
     int rc = avformat_open_input(&container, filePath.c_str(), NULL, NULL);
     if (rc < 0)
     {
         char errbuf[2048];
         av_strerror(rc, errbuf, 2048);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not open input: " << errbuf << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not open input: " << errbuf;
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
     avFormat = std::string(container->iformat->name);
+    lap(Profile::STAGE_OPEN);
+    mark("open");
 
     if (verbose)
     {
-        #pragma omp critical
-        std::cout << "[" << fileName << "] " << "Container: " << container->iformat->long_name << " [" << avFormat  << "]" << std::endl;
+        Log(LOG_INFO, fileId) << "[" << fileName << "] " << "Container: " << container->iformat->long_name << " [" << avFormat  << "]";
     }
 
     rc = avformat_find_stream_info(container, NULL);
@@ -114,11 +297,12 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
         char errbuf[2048];
         av_strerror(rc, errbuf, 2048);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not find stream info: " << errbuf << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not find stream info: " << errbuf;
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
+    lap(Profile::STAGE_STREAM_INFO);
+    mark("stream info");
 
     /* select the audio stream */
     AVCodec *codec;
@@ -134,8 +318,7 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
     {
         avformat_close_input(&container);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not find audio stream!" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not find audio stream!";
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
@@ -146,8 +329,7 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
     {
         avformat_close_input(&container);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not allocate audio codec context!" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not allocate audio codec context!";
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
@@ -164,8 +346,7 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
         char errbuf[2048];
         av_strerror(rc, errbuf, 2048);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not open codec: " << errbuf << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not open codec: " << errbuf;
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
@@ -190,11 +371,11 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
 
     if (verbose)
     {
-        #pragma omp critical
-        std::cout << "[" << fileName << "] " << "Stream #" << stream_id << ": " << codec->long_name << ", " << infotext << " " << ctx->sample_rate << " Hz, " << ctx->channels << " ch, " << infobuf << std::endl;
+        Log(LOG_INFO, fileId) << "[" << fileName << "] " << "Stream #" << stream_id << ": " << codec->long_name << ", " << infotext << " " << ctx->sample_rate << " Hz, " << ctx->channels << " ch, " << infobuf;
     }
 
     avCodecId = codec->id;
+    format = format_find(avFormat.c_str(), avCodecId);
 
     if (!loudness)
     {
@@ -212,12 +393,14 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
         avcodec_free_context(&ctx);
         avformat_close_input(&container);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not initialize EBU R128 scanner!" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not initialize EBU R128 scanner!";
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
 
+    if (curve.interval > 0)
+        curve.start(ctx->sample_rate);
+
     AVFrame *frame = av_frame_alloc();
 
     if (frame == NULL)
@@ -225,23 +408,25 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
         avformat_close_input(&container);
         avcodec_free_context(&ctx);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not allocate frame!" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not allocate frame!";
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
 
     SwrContext *swr = swr_alloc();
     AVPacket packet;
+    lap(Profile::STAGE_OPEN);
+    mark("codec open");
     while (av_read_frame(container, &packet) >= 0 && scanStatus != SCANSTATUS::FAIL)
     {
+        lap(Profile::STAGE_DEMUX);
+
         if (packet.stream_index == stream_id)
         {
             rc = avcodec_send_packet(ctx, &packet);
             if (rc < 0)
             {
-                #pragma omp critical
-                std::cerr << "[" << fileName << "] " << "Error while sending a packet to the decoder!" << std::endl;
+                Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Error while sending a packet to the decoder!";
                 scanStatus = SCANSTATUS::FAIL;
                 break;
             }
@@ -249,20 +434,19 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
             while (rc >= 0 && scanStatus != SCANSTATUS::FAIL)
             {
                 rc = avcodec_receive_frame(ctx, frame);
+                lap(Profile::STAGE_DECODE);
                 if (rc == AVERROR(EAGAIN) || rc == AVERROR_EOF)
                     break;
                 else if (rc < 0)
                 {
-                    #pragma omp critical
-                    std::cerr << "[" << fileName << "] " << "Error while receiving a frame from the decoder!" << std::endl;
+                    Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Error while receiving a frame from the decoder!";
                     scanStatus = SCANSTATUS::FAIL;
                     break;
                 }
 
                 if (!scanFrame(eburState, frame, swr))
                 {
-                    #pragma omp critical
-                    std::cerr << "[" << fileName << "] " << "Error while scanning frame!" << std::endl;
+                    Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Error while scanning frame!";
                     scanStatus = SCANSTATUS::FAIL;
                     break;
                 }
@@ -273,6 +457,18 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
 
         av_packet_unref(&packet);
     }
+    lap(Profile::STAGE_DEMUX);
+    if (trace != NULL)
+    {
+        char args[160];
+        snprintf(args, sizeof(args), "\"demux_ms\":%.3f,\"decode_ms\":%.3f,\"resample_ms\":%.3f,\"meter_ms\":%.3f",
+                 stageTimes[Profile::STAGE_DEMUX] / 1e6, stageTimes[Profile::STAGE_DECODE] / 1e6,
+                 stageTimes[Profile::STAGE_RESAMPLE] / 1e6, stageTimes[Profile::STAGE_METER] / 1e6);
+        mark("decode", args);
+    }
+
+    if (container->pb != NULL)
+        scannedBytes = uint64_t(container->pb->bytes_read);
 
     /* Free */
     av_frame_free(&frame);
@@ -287,8 +483,7 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
     double global_loudness;
     if (ebur128_loudness_global(eburState, &global_loudness) != EBUR128_SUCCESS)
     {
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Error while calculating loudness!" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Error while calculating loudness!";
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
@@ -296,8 +491,7 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
     double loudness_range;
     if (ebur128_loudness_range(eburState, &loudness_range) != EBUR128_SUCCESS)
     {
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Error while calculating loudness range!" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Error while calculating loudness range!";
         scanStatus = SCANSTATUS::FAIL;
         return false;
     }
@@ -317,6 +511,9 @@ bool AudioFile::scanFile(double pregain, bool loudness, bool verbose)
     if (avCodecId == AV_CODEC_ID_OPUS)
         pregain -= 5.0;
 
+    lap(Profile::STAGE_QUERY);
+    mark("query");
+
     trackGain = LUFS_TO_RG(global_loudness) + pregain;
     trackPeak = peak;
     trackLoudness = global_loudness;
@@ -347,11 +544,12 @@ bool AudioFile::scanFrame(ebur128_state *ebur128, AVFrame *frame, SwrContext *sw
         char errbuf[2048];
         av_strerror(rc, errbuf, 2048);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Could not open SWResample: " << errbuf << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Could not open SWResample: " << errbuf;
         return false;
     }
 
+    lap(Profile::STAGE_RESAMPLE);   // the setup above, too
+
     int out_linesize;
     size_t out_size = av_samples_get_buffer_size(&out_linesize, frame -> channels, frame -> nb_samples, AV_SAMPLE_FMT_S16, 0);
     uint8_t *out_data = (uint8_t *) av_malloc(out_size);
@@ -361,21 +559,45 @@ bool AudioFile::scanFrame(ebur128_state *ebur128, AVFrame *frame, SwrContext *sw
         swr_close(swr);
         av_free(out_data);
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Cannot convert" << std::endl;
+        Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Cannot convert";
         return false;
     }
+    lap(Profile::STAGE_RESAMPLE);
 
-    rc = ebur128_add_frames_short(ebur128, (short *) out_data, frame -> nb_samples);
-
-    if (rc != EBUR128_SUCCESS)
+    /* Feed the meter up to each point of the loudness curve, so points are
+       sample-accurate whatever the codec's frame size */
+    unsigned long done = 0;
+    while (done < (unsigned long) frame -> nb_samples)
     {
-        swr_close(swr);
-        av_free(out_data);
+        unsigned long frames = frame -> nb_samples - done;
+        if (curve.interval > 0)
+            frames = std::min(frames, curve.due());
 
-        #pragma omp critical
-        std::cerr << "[" << fileName << "] " << "Error filtering" << std::endl;
-        return false;
+        rc = ebur128_add_frames_short(ebur128, (short *) out_data + done * frame -> channels, frames);
+
+        if (rc != EBUR128_SUCCESS)
+        {
+            swr_close(swr);
+            av_free(out_data);
+
+            Log(LOG_ERROR, fileId) << "[" << fileName << "] " << "Error filtering";
+            return false;
+        }
+
+        done += frames;
+        scannedSeconds += double(frames) / frame -> sample_rate;
+        lap(Profile::STAGE_METER);
+
+        if (curve.interval > 0 && curve.advance(frames))
+        {
+            double momentary, shortterm;
+            if (ebur128_loudness_momentary(ebur128, &momentary) != EBUR128_SUCCESS)
+                momentary = -HUGE_VAL;
+            if (ebur128_loudness_shortterm(ebur128, &shortterm) != EBUR128_SUCCESS)
+                shortterm = -HUGE_VAL;
+            curve.add(momentary, shortterm);
+            lap(Profile::STAGE_QUERY);
+        }
     }
 
     swr_close(swr);
@@ -486,8 +708,7 @@ bool AudioFolder::processResults(double pregain)
     {
         scanStatus = SCANSTATUS::FAIL;
 
-        #pragma omp critical
-        std::cerr << "Cannot calculate correct album gain when mixing Opus and non-Opus files!" << std::endl;
+        Log(LOG_ERROR) << "Cannot calculate correct album gain when mixing Opus and non-Opus files!";
         return false;
     }
 
@@ -505,7 +726,7 @@ bool AudioFolder::processResults(double pregain)
     {
         free(ebuR128States);
         scanStatus = SCANSTATUS::FAIL;
-        std::cerr << "Album loudness fail!" << std::endl;
+        Log(LOG_ERROR) << "Album loudness fail!";
         return false;
     }
 
@@ -515,8 +736,7 @@ bool AudioFolder::processResults(double pregain)
         free(ebuR128States);
         scanStatus = SCANSTATUS::FAIL;
 
-        #pragma omp critical
-        std::cerr << "Album loudness range fail!" << std::endl;
+        Log(LOG_ERROR) << "Album loudness range fail!";
         return false;
     }
 
@@ -615,21 +835,38 @@ bool AudioLibrary::removeReplayGainTags(LoudGain &lg)
     std::vector<std::string> files{fset.begin(), fset.end()};
     fset.clear();
 
+    lg.progress.start(files, lg.progressInterval);
+
     #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) if (nthreads > 1)
     for (int i = 0; i < int(files.size()); i++)
     {
         AudioFile audio_file = AudioFile(files[i]);
-        if (audio_file.scanFile(0.0, false, (lg.verbosity >= 3)))
+        audio_file.fileId = i;
+        audio_file.writeInPlace = lg.writesInPlace();
+
+        // the file header tells which tags to clear, FFmpeg probing is
+        // only needed for files that aren't that obvious
+        if (audio_file.probeFile(lg.verbosity >= 3) ||
+            audio_file.scanFile(0.0, false, (lg.verbosity >= 3)))
             lg.removeReplayGainTags(audio_file);
+
+        lg.progress.fileDone(audio_file);
     }
 
+    lg.progress.stop();
+
     return true;
 }
 
 bool AudioLibrary::scanLibrary(LoudGain &lg)
 {   
     if (lg.tabOutput)
-        std::cout << "File\tLoudness\tRange\tTrue_Peak\tTrue_Peak_dBTP\tReference\tWill_clip\tClip_prevent\tGain\tNew_Peak\tNew_Peak_dBTP" << std::endl;
+    {
+        std::cout << "File\tLoudness\tRange\tTrue_Peak\tTrue_Peak_dBTP\tReference\tWill_clip\tClip_prevent\tGain\tNew_Peak\tNew_Peak_dBTP";
+        for (const LoudGain::GainTarget &target : lg.gainTargets)
+            std::cout << "\tGain_" << target.reference << "_LUFS\tNew_Peak_dBTP_" << target.reference << "_LUFS";
+        std::cout << std::endl;
+    }
 
     int nthreads = std::max<int>(1, lg.numberOfThreads);
 
@@ -647,22 +884,64 @@ bool AudioLibrary::scanLibrary(LoudGain &lg)
         }
         sorted_audio_files.clear();
 
-        #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) if (nthreads > 1)
-        for (int i = 0; i < int(audio_files.size()); i++)
+        if (lg.progressInterval > 0)
+        {
+            std::vector<std::string> paths;
+            paths.reserve(audio_files.size());
+            for (const auto &entry : audio_files)
+                paths.push_back(entry.second->filePath);
+            lg.progress.start(paths, lg.progressInterval);
+        }
+
+        auto scan = [&](int i)
         {
+            uint64_t start = Profile::now();
+            lg.prepareFile(*audio_files[i].second, i);
             audio_files[i].second->scanFile(lg.pregain, true, (lg.verbosity >= 3));
+            lg.fileScanned(*audio_files[i].second, start);
+
+            // an album's tracks stay open until its tags are written; those
+            // of big ones are reopened by path instead, or they'd run out
+            // of descriptors
+            if (audio_files[i].first->count() > maxOpenTracks)
+                audio_files[i].second->closeFile();
+            lg.trace.addFile("file", *audio_files[i].second, start);
+            lg.progress.fileDone(*audio_files[i].second);
 
             if (audio_files[i].first.use_count() == 1)
             {
                 if (audio_files[i].first->canProcessResults() && audio_files[i].first->scanStatus == AudioFolder::INIT)
                 {
+                    start = Profile::now();
                     audio_files[i].first->processResults(lg.pregain);
                     lg.processFolderResults(*audio_files[i].first.get());
+                    if (lg.trace.isOn())
+                        lg.trace.add("album", audio_files[i].first->getAudioFile(0)->fileId, start, Profile::now(),
+                                     "\"directory\":" + Trace::quote(audio_files[i].first->directory));
+                    lg.progress.albumDone();
                 }
+                lg.completeOutput(audio_files[i].first->getAudioFile(0)->fileId, audio_files[i].first->count());
             }
             audio_files[i].first.reset();
             audio_files[i].second.reset();
+        };
+
+#if defined(_OPENMP) && _OPENMP >= 200805
+        // One task per file instead of a loop: the tag writes of a finished
+        // album are tasks, too (see LoudGain::writeAlbumTags), and workers
+        // done with their file take those as well as the next file.
+        #pragma omp parallel num_threads(nthreads) if (nthreads > 1)
+        #pragma omp single
+        for (int i = 0; i < int(audio_files.size()); i++)
+        {
+            #pragma omp task firstprivate(i)
+            scan(i);
         }
+#else
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) if (nthreads > 1)
+        for (int i = 0; i < int(audio_files.size()); i++)
+            scan(i);
+#endif
     }
     else
     {
@@ -670,15 +949,27 @@ bool AudioLibrary::scanLibrary(LoudGain &lg)
         std::vector<std::string> files{fset.begin(), fset.end()};
         fset.clear();
 
+        lg.progress.start(files, lg.progressInterval);
+
         #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) if (nthreads > 1)
         for (int i = 0; i < int(files.size()); i++)
         {           
-            AudioFile audio_file = AudioFile(files[i]);
-            audio_file.scanFile(lg.pregain, true, (lg.verbosity >= 3));
-            lg.processFileResults(audio_file);
+            uint64_t start = Profile::now();
+            std::shared_ptr<AudioFile> audio_file = std::make_shared<AudioFile>(files[i]);
+            lg.prepareFile(*audio_file, i);
+            audio_file->scanFile(lg.pregain, true, (lg.verbosity >= 3));
+            lg.fileScanned(*audio_file, start);
+            lg.processFileResults(*audio_file);
+            lg.completeOutput(i);
+            lg.trace.addFile("file", *audio_file, start);
+            lg.progress.fileDone(*audio_file);
+
+            if (lg.deferWrites)
+                lg.deferTagWrite(audio_file);
         }
     }
 
+    lg.progress.stop();
     return true;
 }
 
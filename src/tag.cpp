@@ -51,10 +51,19 @@
  */
 
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <memory>
+#include <algorithm>
 #include <scan.hpp>
 #include <tag.hpp>
 
 #include <taglib/taglib.h>
+#include <taglib/tfilestream.h>
 #include <taglib/textidentificationframe.h>
 #include <taglib/mpegfile.h>
 #include <taglib/id3v2tag.h>
@@ -78,6 +87,176 @@
                         + TAGLIB_MINOR_VERSION * 100 \
                         + TAGLIB_PATCH_VERSION)
 
+#if TAGLIB_MAJOR_VERSION >= 2
+typedef TagLib::offset_t tag_offset_t;
+typedef TagLib::offset_t tag_start_t;
+typedef size_t tag_size_t;
+#else
+typedef long tag_offset_t;
+typedef unsigned long tag_start_t;     // insert()/removeBlock() offsets
+typedef unsigned long tag_size_t;
+#endif
+
+// Dry run: the writers work as usual, but on an in-memory overlay over the
+// (read-only) file, which also counts what a real save would have written.
+// Bytes behind a change in size would have to move: a rewrite.
+class PlanStream : public TagLib::IOStream {
+public:
+    PlanStream(AudioFile *audio_file, TagLib::IOStream *file)
+        : audio_file(audio_file), file(file) {
+        size = file->length();
+        if (size > 0)
+            pieces.push_back({0, size, TagLib::ByteVector()});
+    }
+
+    ~PlanStream() {
+        audio_file->plannedBytes += written;
+        if (moved > 0)
+            audio_file->tagStatus = AudioFile::TAGSTATUS::REWRITTEN;
+    }
+
+    TagLib::FileName name() const { return file->name(); }
+    bool readOnly() const { return false; }
+    bool isOpen() const { return file->isOpen(); }
+    tag_offset_t tell() const { return tag_offset_t(position); }
+    tag_offset_t length() { return tag_offset_t(size); }
+
+    void seek(tag_offset_t offset, Position p = Beginning) {
+        if (p == Current)
+            position += offset;
+        else if (p == End)
+            position = size + offset;
+        else
+            position = offset;
+    }
+
+    TagLib::ByteVector readBlock(tag_size_t length) {
+        TagLib::ByteVector data;
+        long long end = std::min<long long>(position + (long long) length, size);
+        long long at = 0;
+
+        for (const Piece &piece : pieces) {
+            long long pieceEnd = at + piece.length;
+            if (pieceEnd > position && at < end) {
+                long long from = std::max<long long>(position, at);
+                long long to = std::min<long long>(end, pieceEnd);
+                if (piece.source >= 0) {
+                    file->seek(tag_offset_t(piece.source + from - at));
+                    data.append(file->readBlock(tag_size_t(to - from)));
+                } else
+                    data.append(piece.data.mid((unsigned int) (from - at), (unsigned int) (to - from)));
+            }
+            at = pieceEnd;
+            if (at >= end)
+                break;
+        }
+
+        position += data.size();
+        return data;
+    }
+
+    void writeBlock(const TagLib::ByteVector &data) {
+        if (position > size)
+            replace(size, 0, TagLib::ByteVector((unsigned int) (position - size), 0));
+        replace(position, std::min<long long>(data.size(), size - position), data);
+        written += data.size();
+        position += data.size();
+    }
+
+    void insert(const TagLib::ByteVector &data, tag_start_t start = 0, tag_size_t length = 0) {
+        long long tail = std::max<long long>(0, size - (long long) start - (long long) length);
+        replace(start, (long long) length, data);
+        written += data.size();
+        if (data.size() != length) {
+            written += tail;
+            moved += tail;
+        }
+    }
+
+    void removeBlock(tag_start_t start = 0, tag_size_t length = 0) {
+        long long tail = std::max<long long>(0, size - (long long) start - (long long) length);
+        replace(start, (long long) length, TagLib::ByteVector());
+        written += tail;
+        moved += tail;
+    }
+
+    void truncate(tag_offset_t length) {
+        if (length < size)
+            replace(length, size - length, TagLib::ByteVector());
+        else
+            replace(size, 0, TagLib::ByteVector((unsigned int) (length - size), 0));
+    }
+
+private:
+    struct Piece {
+        long long source;           // offset in the file, -1: data
+        long long length;
+        TagLib::ByteVector data;
+    };
+
+    // append the pieces covering [from, to) of the current content
+    void slice(std::vector<Piece> &out, long long from, long long to) const {
+        long long at = 0;
+        for (const Piece &piece : pieces) {
+            long long pieceEnd = at + piece.length;
+            if (pieceEnd > from && at < to) {
+                long long off = std::max<long long>(from, at) - at;
+                long long len = std::min<long long>(to, pieceEnd) - at - off;
+                if (piece.source >= 0)
+                    out.push_back({piece.source + off, len, TagLib::ByteVector()});
+                else
+                    out.push_back({-1, len, piece.data.mid((unsigned int) off, (unsigned int) len)});
+            }
+            at = pieceEnd;
+        }
+    }
+
+    void replace(long long start, long long length, const TagLib::ByteVector &data) {
+        std::vector<Piece> result;
+        start = std::min<long long>(start, size);
+        length = std::min<long long>(length, size - start);
+        slice(result, 0, start);
+        if (data.size() > 0)
+            result.push_back({-1, (long long) data.size(), data});
+        slice(result, start + length, size);
+        pieces.swap(result);
+        size += (long long) data.size() - length;
+    }
+
+    AudioFile *audio_file;
+    std::unique_ptr<TagLib::IOStream> file;
+    std::vector<Piece> pieces;
+    long long size = 0;
+    long long position = 0;
+    long long written = 0;
+    long long moved = 0;
+};
+
+// The stream the writers save through: the descriptor the scan opened,
+// if still there, opened for writing (or the save only planned) and tags
+// go to the file itself (not a reflinked clone).
+// Audio properties were read by FFmpeg already, TagLib needn't parse them.
+static std::unique_ptr<TagLib::IOStream> tag_open(AudioFile *audio_file) {
+    std::unique_ptr<TagLib::IOStream> stream;
+
+#if TAGLIB_VERSION >= 11100 && !defined(_WIN32)
+    if (audio_file->fileHandle && audio_file->fileHandle->isOpen() &&
+        audio_file->tagPath == audio_file->filePath &&
+        (!audio_file->fileHandle->isReadOnly() || audio_file->dryRun)) {
+        int fd = audio_file->fileHandle->duplicate();
+        if (fd >= 0)
+            stream.reset(new TagLib::FileStream(fd, audio_file->fileHandle->isReadOnly() || audio_file->dryRun));
+    }
+#endif
+    if (!stream)
+        stream.reset(new TagLib::FileStream(audio_file->tagPath.c_str(), audio_file->dryRun));
+
+    if (audio_file->dryRun)
+        stream.reset(new PlanStream(audio_file, stream.release()));
+
+    return stream;
+}
+
 
 // define possible replaygain tags
 enum RG_ENUM {
@@ -113,10 +292,251 @@ static const char *RG_STRING_LOWER[] = {
 // this is where we store the RG tags in MP4/M4A files
 static const char *RG_ATOM = "----:com.apple.iTunes:";
 
+// the (formatted) ReplayGain tags we are going to write, in write order
+typedef std::vector<std::pair<std::string, std::string>> rg_list;
+
+// the ReplayGain tags currently in a file: tag name as stored → values
+typedef std::map<std::string, std::vector<std::string>> rg_found;
+
+
+/*** Write avoidance ***/
+
+// Build the list of tags to write. All tag writers share the same formats,
+// so we can compare with what is already in the file before touching it.
+static rg_list tag_make_rg_list(AudioFile *audio_file, bool do_album, char mode,
+  char *unit, const char **RG_STRING) {
+  char value[2048];
+  rg_list rg;
+
+  snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
+  rg.push_back({RG_STRING[RG_TRACK_GAIN], value});
+
+  snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
+  rg.push_back({RG_STRING[RG_TRACK_PEAK], value});
+
+  // Only write album tags if in album mode (would be zero otherwise)
+  if (do_album) {
+    snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
+    rg.push_back({RG_STRING[RG_ALBUM_GAIN], value});
+
+    snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
+    rg.push_back({RG_STRING[RG_ALBUM_PEAK], value});
+  }
+
+  // extra tags mode -s e or -s l
+  if (mode == 'e' || mode == 'l') {
+    snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
+    rg.push_back({RG_STRING[RG_REFERENCE_LOUDNESS], value});
+
+    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
+    rg.push_back({RG_STRING[RG_TRACK_RANGE], value});
+
+    if (do_album) {
+      snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
+      rg.push_back({RG_STRING[RG_ALBUM_RANGE], value});
+    }
+  }
+
+  return rg;
+}
+
+// true if desc (already uppercased) is one of the REPLAYGAIN_* tags we handle
+static bool tag_is_rg(const TagLib::String &desc) {
+  for (const char *key : RG_STRING_UPPER)
+    if (desc == key)
+      return true;
+  return false;
+}
+
+// The file is up to date if it holds exactly the tags we would write:
+// same names (including case), one value each, and no other RG tags.
+static bool tag_rg_unchanged(const rg_found &found, const rg_list &rg) {
+  if (found.size() != rg.size())
+    return false;
+
+  for (const auto &item : rg) {
+    rg_found::const_iterator it = found.find(item.first);
+    if (it == found.end() || it->second.size() != 1 || it->second[0] != item.second)
+      return false;
+  }
+
+  return true;
+}
+
+static rg_found tag_find_id3v2(TagLib::ID3v2::Tag *tag) {
+  rg_found found;
+  TagLib::ID3v2::FrameList frames = tag -> frameList("TXXX");
+
+  for (TagLib::ID3v2::FrameList::Iterator it = frames.begin(); it != frames.end(); ++it) {
+    TagLib::ID3v2::UserTextIdentificationFrame *frame =
+      dynamic_cast<TagLib::ID3v2::UserTextIdentificationFrame*>(*it);
+
+    if (frame && frame -> fieldList().size() >= 2 && tag_is_rg(frame -> description().upper())) {
+      std::vector<std::string> &values = found[frame -> description().to8Bit(true)];
+      TagLib::StringList fields = frame -> fieldList();
+      for (unsigned int i = 1; i < fields.size(); i++)
+        values.push_back(fields[i].to8Bit(true));
+    }
+  }
+
+  return found;
+}
+
+// XiphComment keys are always stored uppercase
+static rg_found tag_find_xiph(TagLib::Ogg::XiphComment *tag, bool opus) {
+  rg_found found;
+  const TagLib::Ogg::FieldListMap &fields = tag -> fieldListMap();
+  std::vector<std::string> keys(std::begin(RG_STRING_UPPER), std::end(RG_STRING_UPPER));
+
+  if (opus) {
+    keys.push_back("R128_TRACK_GAIN");
+    keys.push_back("R128_ALBUM_GAIN");
+  }
+
+  for (const std::string &key : keys) {
+    TagLib::Ogg::FieldListMap::ConstIterator it = fields.find(key.c_str());
+    if (it == fields.end())
+      continue;
+    std::vector<std::string> &values = found[key];
+    for (TagLib::StringList::ConstIterator v = it->second.begin(); v != it->second.end(); ++v)
+      values.push_back(v->to8Bit(true));
+  }
+
+  return found;
+}
+
+
+/*** ID3v2 padding ***/
+
+// TagLib makes room for a growing ID3v2 tag by moving all audio data behind
+// it, i.e. rewriting the whole file. We therefore lay out the tag ourselves:
+// If the new frames fit into the old tag (including its padding), the tag
+// keeps its exact size and can be overwritten in place. Otherwise we reserve
+// `padding` extra bytes, so that the next update will fit again.
+
+static unsigned int id3v2_syncsafe(const TagLib::ByteVector &data) {
+  unsigned int sum = 0;
+  for (unsigned int i = 0; i < 4; i++)
+    sum = (sum << 7) | (data[i] & 0x7f);
+  return sum;
+}
+
+static TagLib::ByteVector id3v2_render_syncsafe(unsigned int size) {
+  TagLib::ByteVector v(4, 0);
+  for (unsigned int i = 0; i < 4; i++)
+    v[i] = char((size >> ((3 - i) * 7)) & 0x7f);
+  return v;
+}
+
+// Render the tag to exactly `size` bytes if possible, else to its frames plus
+// `padding`. Returns an empty vector if we can't handle the rendered layout.
+static TagLib::ByteVector tag_render_id3v2(TagLib::ID3v2::Tag *tag, int id3v2version,
+  unsigned long size, long padding) {
+#if TAGLIB_VERSION >= 11200
+  TagLib::ByteVector data = tag -> render(id3v2version == 3 ? TagLib::ID3v2::v3 : TagLib::ID3v2::v4);
+#else
+  TagLib::ByteVector data = tag -> render(id3v2version);
+#endif
+
+  // header: "ID3", version (2), flags (1), syncsafe size (4); no footer
+  if (data.size() < 10 || !data.startsWith("ID3") || (data[5] & 0x10))
+    return TagLib::ByteVector();
+
+  // skip over the frames to find where TagLib's own padding starts
+  unsigned int version = (unsigned char) data[3];
+  unsigned int end = 10;
+  while (end + 10 <= data.size() && data[end] != 0) {
+    TagLib::ByteVector frameSize = data.mid(end + 4, 4);
+    end += 10 + (version >= 4 ? id3v2_syncsafe(frameSize) : frameSize.toUInt());
+  }
+  if (end > data.size())
+    return TagLib::ByteVector();
+
+  unsigned long total = end <= size ? size : end + (unsigned long) padding;
+  if (total - 10 >= (1UL << 28))
+    return TagLib::ByteVector();
+
+  TagLib::ByteVector result = data.mid(0, end);
+  result.resize((unsigned int) total, 0);
+
+  TagLib::ByteVector length = id3v2_render_syncsafe((unsigned int) (total - 10));
+  for (unsigned int i = 0; i < 4; i++)
+    result[6 + i] = length[i];
+
+  return result;
+}
+
+// Write the ID3v2 tag at the start of an MP3 file. Returns 1 on success,
+// 0 on failure and -1 if TagLib should handle this file itself.
+static int tag_save_id3v2_mp3(AudioFile *audio_file, TagLib::MPEG::File &f,
+  TagLib::ID3v2::Tag *tag, int id3v2version, long padding) {
+  unsigned long size = 0;
+
+  // an empty tag must be removed, and TagLib knows where else it might live
+  if (f.readOnly() || tag -> frameList().isEmpty())
+    return -1;
+
+  if (f.hasID3v2Tag()) {
+    f.seek(0);
+    if (!f.readBlock(3).startsWith("ID3") || tag -> header() -> footerPresent())
+      return -1;
+    size = tag -> header() -> completeTagSize();
+  }
+
+  TagLib::ByteVector data = tag_render_id3v2(tag, id3v2version, size, padding);
+  if (data.isEmpty())
+    return -1;
+
+  if (data.size() != size)
+    audio_file->tagStatus = AudioFile::TAGSTATUS::REWRITTEN;
+
+  f.insert(data, 0, size);
+  return 1;
+}
+
+// RIFF::File keeps its chunk list protected; this exposes the "ID3 " chunk
+// of WAV and AIFF files so we can replace it within its current size.
+template <class T>
+class ID3ChunkFile : public T {
+public:
+  using T::T;
+
+  int id3Chunk() {
+    for (unsigned int i = 0; i < this->chunkCount(); i++)
+      if (this->chunkName(i) == "ID3 " || this->chunkName(i) == "id3 ")
+        return int(i);
+    return -1;
+  }
+
+  // Returns 1 on success, 0 on failure and -1 if TagLib should handle it.
+  int saveID3v2(AudioFile *audio_file, TagLib::ID3v2::Tag *tag, int id3v2version, long padding) {
+    if (this->readOnly() || tag -> frameList().isEmpty())
+      return -1;
+
+    int chunk = id3Chunk();
+    unsigned long size = chunk >= 0 ? this->chunkDataSize(chunk) : 0;
+
+    TagLib::ByteVector data = tag_render_id3v2(tag, id3v2version, size, padding);
+    if (data.isEmpty())
+      return -1;
+
+    // a new chunk is simply appended, so only a resized chunk in front of
+    // other chunks (i.e. the audio data) causes a rewrite
+    if (chunk < 0) {
+      this->setChunkData("ID3 ", data);
+    } else {
+      if (data.size() != size && chunk != int(this->chunkCount()) - 1)
+        audio_file->tagStatus = AudioFile::TAGSTATUS::REWRITTEN;
+      this->setChunkData(chunk, data);
+    }
+    return 1;
+  }
+};
+
 
 /*** MP3 ****/
 
-static void tag_add_txxx(TagLib::ID3v2::Tag *tag, char *name, char *value) {
+static void tag_add_txxx(TagLib::ID3v2::Tag *tag, const char *name, const char *value) {
   TagLib::ID3v2::UserTextIdentificationFrame *frame =
     new TagLib::ID3v2::UserTextIdentificationFrame;
 
@@ -151,83 +571,75 @@ void tag_remove_mp3(TagLib::ID3v2::Tag *tag) {
   }
 }
 
+static bool tag_save_mp3(AudioFile *audio_file, TagLib::MPEG::File &f,
+  TagLib::ID3v2::Tag *tag, bool strip, int id3v2version, long padding) {
+  // APE and ID3v1 live at the end of the file, so stripping them is cheap;
+  // work around bug taglib/taglib#913: strip APE before ID3v1
+  if (strip) {
+    f.strip(TagLib::MPEG::File::APE);
+    f.strip(TagLib::MPEG::File::ID3v1);
+  }
+
+  int rc = tag_save_id3v2_mp3(audio_file, f, tag, id3v2version, padding);
+  if (rc >= 0)
+    return rc == 1;
+
+#if TAGLIB_VERSION >= 11200
+  return f.save(TagLib::MPEG::File::ID3v2, TagLib::MPEG::File::StripNone,
+    id3v2version == 3 ? TagLib::ID3v2::v3 : TagLib::ID3v2::v4);
+#else
+  return f.save(TagLib::MPEG::File::ID3v2, false, id3v2version);
+#endif
+}
+
 // Even if the ReplayGain 2 standard proposes replaygain tags to be uppercase,
 // unfortunately some players only respect the lowercase variant (still).
 // So we use the "lowercase" flag to switch.
 bool tag_write_mp3(AudioFile *audio_file, bool do_album, char mode, char *unit,
-  bool lowercase, bool strip, int id3v2version) {
-  char value[2048];
+  bool lowercase, bool strip, int id3v2version, long padding) {
   const char **RG_STRING = RG_STRING_UPPER;
 
   if (lowercase) {
     RG_STRING = RG_STRING_LOWER;
   }
 
-  TagLib::MPEG::File f(audio_file->filePath.c_str());
-  TagLib::ID3v2::Tag *tag = f.ID3v2Tag(true);
-
-  // remove old tags before writing new ones
-  tag_remove_mp3(tag);
-
-  snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-  tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_GAIN]), value);
+  rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
 
-  snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-  tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_PEAK]), value);
-
-  // Only write album tags if in album mode (would be zero otherwise)
-  if (do_album) {
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_GAIN]), value);
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::MPEG::File f(stream.get(), TagLib::ID3v2::FrameFactory::instance(), false);
+  TagLib::ID3v2::Tag *tag = f.ID3v2Tag(true);
 
-    snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_PEAK]), value);
+  // nothing to do if tags, ID3v2 version and stripping are already as requested
+  if (tag_rg_unchanged(tag_find_id3v2(tag), rg)
+      && int(tag -> header() -> majorVersion()) == id3v2version
+      && !(strip && (f.hasAPETag() || f.hasID3v1Tag()))) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
   }
 
-  // extra tags mode -s e or -s l
-  if (mode == 'e' || mode == 'l') {
-    snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_REFERENCE_LOUDNESS]), value);
-
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_RANGE]), value);
-
-    if (do_album) {
-      snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-      tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_RANGE]), value);
-    }
-  }
+  // remove old tags before writing new ones
+  tag_remove_mp3(tag);
 
-  // work around bug taglib/taglib#913: strip APE before ID3v1
-  if (strip)
-    f.strip(TagLib::MPEG::File::APE);
+  for (const auto &item : rg)
+    tag_add_txxx(tag, item.first.c_str(), item.second.c_str());
 
-#if TAGLIB_VERSION >= 11200
-  return f.save(TagLib::MPEG::File::ID3v2,
-    strip ? TagLib::MPEG::File::StripOthers : TagLib::MPEG::File::StripNone,
-    id3v2version == 3 ? TagLib::ID3v2::v3 : TagLib::ID3v2::v4);
-#else
-  return f.save(TagLib::MPEG::File::ID3v2, strip, id3v2version);
-#endif
+  return tag_save_mp3(audio_file, f, tag, strip, id3v2version, padding);
 }
 
 bool tag_clear_mp3(AudioFile *audio_file, bool strip, int id3v2version) {
-  TagLib::MPEG::File f(audio_file->filePath.c_str());
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::MPEG::File f(stream.get(), TagLib::ID3v2::FrameFactory::instance(), false);
   TagLib::ID3v2::Tag *tag = f.ID3v2Tag(true);
 
-  tag_remove_mp3(tag);
+  // no RG tags and nothing to strip: leave the file alone
+  if (tag_find_id3v2(tag).empty() && !(strip && (f.hasAPETag() || f.hasID3v1Tag()))) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
 
-  // work around bug taglib/taglib#913: strip APE before ID3v1
-  if (strip)
-    f.strip(TagLib::MPEG::File::APE);
+  tag_remove_mp3(tag);
 
-#if TAGLIB_VERSION >= 11200
-  return f.save(TagLib::MPEG::File::ID3v2,
-    strip ? TagLib::MPEG::File::StripOthers : TagLib::MPEG::File::StripNone,
-    id3v2version == 3 ? TagLib::ID3v2::v3 : TagLib::ID3v2::v4);
-#else
-  return f.save(TagLib::MPEG::File::ID3v2, strip, id3v2version);
-#endif
+  return tag_save_mp3(audio_file, f, tag, strip, id3v2version, 0);
 }
 
 
@@ -243,53 +655,197 @@ void tag_remove_flac(TagLib::Ogg::XiphComment *tag) {
   tag -> removeFields(RG_STRING_UPPER[RG_REFERENCE_LOUDNESS]);
 }
 
-bool tag_write_flac(AudioFile *audio_file, bool do_album, char mode, char *unit) {
-  char value[2048];
+// FLAC metadata: "fLaC", then blocks of a 4-byte header (last-block flag,
+// 7-bit type, 24-bit length) and data, up to the first audio frame.
+enum FLAC_BLOCK {
+  FLAC_STREAMINFO = 0,
+  FLAC_PADDING = 1,
+  FLAC_VORBIS_COMMENT = 4,
+  FLAC_INVALID = 127
+};
 
-  TagLib::FLAC::File f(audio_file->filePath.c_str());
-  TagLib::Ogg::XiphComment *tag = f.xiphComment(true);
+struct flac_block {
+  int type;
+  long offset;            // of the block header
+  unsigned long length;   // of the block data
+};
 
-  // remove old tags before writing new ones
-  tag_remove_flac(tag);
+static TagLib::ByteVector flac_block_header(int type, unsigned long length, bool last) {
+  TagLib::ByteVector header = TagLib::ByteVector::fromUInt((unsigned int) length);
+  header[0] = char(type | (last ? 0x80 : 0));
+  return header;
+}
 
-  snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-  tag -> addField(RG_STRING_UPPER[RG_TRACK_GAIN], value);
+// TagLib re-creates all metadata on save, and if the comment outgrows the
+// PADDING block (or the padding is "too large" by its rules), moves all audio
+// frames. We keep every block except VORBIS_COMMENT and PADDING as is and let
+// the padding absorb the size change, so the audio frames never move.
+// If the comment doesn't fit, the file is rewritten once with `padding` bytes
+// reserve. Returns 1 on success, 0 on failure, -1 if TagLib should save.
+static int tag_save_flac(AudioFile *audio_file, TagLib::FLAC::File &f,
+  TagLib::Ogg::XiphComment *tag, long padding) {
+  if (f.readOnly())
+    return -1;
+
+  // ID3v2 in front of "fLaC" is a mess we leave to TagLib
+  f.seek(0);
+  if (f.readBlock(4) != "fLaC")
+    return -1;
+
+  std::vector<flac_block> blocks;
+  long pos = 4;
+  bool last = false;
+  while (!last) {
+    f.seek(pos);
+    TagLib::ByteVector header = f.readBlock(4);
+    if (header.size() != 4)
+      return -1;
+
+    flac_block block;
+    block.type = header[0] & 0x7f;
+    block.offset = pos;
+    block.length = ((unsigned char) header[1] << 16) | ((unsigned char) header[2] << 8) | (unsigned char) header[3];
+    last = (header[0] & 0x80) != 0;
+
+    if (block.type == FLAC_INVALID || (blocks.empty() && block.type != FLAC_STREAMINFO))
+      return -1;
+
+    blocks.push_back(block);
+    pos += 4 + block.length;
+  }
+  long end = pos;   // first audio frame
+
+  // We rewrite from the first VORBIS_COMMENT or PADDING block onwards
+  // (or the last block, whose "last" flag must go), never STREAMINFO.
+  size_t first = blocks.size() - 1;
+  for (size_t i = 1; i < blocks.size(); i++)
+    if (blocks[i].type == FLAC_VORBIS_COMMENT || blocks[i].type == FLAC_PADDING) {
+      first = i;
+      break;
+    }
+  if (first == 0)
+    first = 1;
+  long start = first < blocks.size() ? blocks[first].offset : end;
+
+  TagLib::ByteVector comment = tag -> render(false);
+  if (comment.size() >= (1U << 24))
+    return -1;
+
+  // assemble the new region: kept blocks in order, the comment in place of
+  // the old one (or in front), padding at the end
+  TagLib::ByteVector region;
+  bool placed = false;
+  long oldPadding = -1;   // data offset of old trailing padding (zeros)
+  for (size_t i = first; i < blocks.size(); i++) {
+    if (blocks[i].type == FLAC_PADDING) {
+      oldPadding = blocks[i].offset + 4;
+      continue;
+    }
+    oldPadding = -1;
+    if (blocks[i].type == FLAC_VORBIS_COMMENT) {
+      if (!placed)
+        region.append(flac_block_header(FLAC_VORBIS_COMMENT, comment.size(), false)).append(comment);
+      placed = true;
+      continue;
+    }
+    if (!placed) {
+      region.append(flac_block_header(FLAC_VORBIS_COMMENT, comment.size(), false)).append(comment);
+      placed = true;
+    }
+    f.seek(blocks[i].offset + 4);
+    region.append(flac_block_header(blocks[i].type, blocks[i].length, false)).append(f.readBlock(blocks[i].length));
+  }
+  if (!placed)
+    region.append(flac_block_header(FLAC_VORBIS_COMMENT, comment.size(), false)).append(comment);
+
+  unsigned long available = (unsigned long) (end - start);
+  if (region.size() == available) {
+    // exact fit, no padding needed: just flag the last block
+    unsigned int lastHeader = 0;
+    for (unsigned int p = 0; p < region.size(); ) {
+      lastHeader = p;
+      p += 4 + (((unsigned char) region[p + 1] << 16) | ((unsigned char) region[p + 2] << 8) | (unsigned char) region[p + 3]);
+    }
+    region[lastHeader] = char(region[lastHeader] | 0x80);
+    f.seek(start);
+    f.writeBlock(region);
+    return 1;
+  }
 
-  snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-  tag -> addField(RG_STRING_UPPER[RG_TRACK_PEAK], value);
+  if (region.size() + 4 <= available) {
+    unsigned long paddingLength = available - region.size() - 4;
+    long paddingStart = start + region.size() + 4;
+    region.append(flac_block_header(FLAC_PADDING, paddingLength, true));
 
-  // Only write album tags if in album mode (would be zero otherwise)
-  if (do_album) {
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-    tag -> addField(RG_STRING_UPPER[RG_ALBUM_GAIN], value);
+    // old trailing padding is zeros already, only overwrite what held data
+    long zerosEnd = oldPadding >= 0 ? std::max(paddingStart, oldPadding) : end;
+    region.resize(region.size() + (unsigned int) (zerosEnd - paddingStart), 0);
 
-    snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-    tag -> addField(RG_STRING_UPPER[RG_ALBUM_PEAK], value);
+    f.seek(start);
+    f.writeBlock(region);
+    return 1;
   }
 
-  // extra tags mode -s e or -s l
-  if (mode == 'e' || mode == 'l') {
-    snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-    tag -> addField(RG_STRING_UPPER[RG_REFERENCE_LOUDNESS], value);
+  // doesn't fit: make room once, with generous padding for the next time
+  if (start == end) {
+    // STREAMINFO was the only block and loses its "last" flag
+    f.seek(4);
+    TagLib::ByteVector flag = f.readBlock(1);
+    flag[0] = char(flag[0] & 0x7f);
+    f.seek(4);
+    f.writeBlock(flag);
+  }
 
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-    tag -> addField(RG_STRING_UPPER[RG_TRACK_RANGE], value);
+  region.append(flac_block_header(FLAC_PADDING, (unsigned long) padding, true));
+  region.resize(region.size() + (unsigned int) padding, 0);
+  audio_file->tagStatus = AudioFile::TAGSTATUS::REWRITTEN;
+  f.insert(region, start, available);
+  return 1;
+}
 
-    if (do_album) {
-      snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-      tag -> addField(RG_STRING_UPPER[RG_ALBUM_RANGE], value);
-    }
+bool tag_write_flac(AudioFile *audio_file, bool do_album, char mode, char *unit,
+  long padding) {
+  rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING_UPPER);
+
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::FLAC::File f(stream.get(), TagLib::ID3v2::FrameFactory::instance(), false);
+  TagLib::Ogg::XiphComment *tag = f.xiphComment(true);
+
+  if (tag_rg_unchanged(tag_find_xiph(tag, false), rg)) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
   }
 
+  // remove old tags before writing new ones
+  tag_remove_flac(tag);
+
+  for (const auto &item : rg)
+    tag -> addField(item.first, TagLib::String(item.second, TagLib::String::UTF8));
+
+  int rc = tag_save_flac(audio_file, f, tag, padding);
+  if (rc >= 0)
+    return rc == 1;
+
   return f.save();
 }
 
-bool tag_clear_flac(AudioFile *audio_file) {
-  TagLib::FLAC::File f(audio_file->filePath.c_str());
+bool tag_clear_flac(AudioFile *audio_file, long padding) {
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::FLAC::File f(stream.get(), TagLib::ID3v2::FrameFactory::instance(), false);
   TagLib::Ogg::XiphComment *tag = f.xiphComment(true);
 
+  if (tag_find_xiph(tag, false).empty()) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
+
   tag_remove_flac(tag);
 
+  // a shrinking comment always fits, unless only 1-3 bytes are left over
+  int rc = tag_save_flac(audio_file, f, tag, std::max(padding, 8L));
+  if (rc >= 0)
+    return rc == 1;
+
   return f.save();
 }
 
@@ -306,79 +862,216 @@ void tag_remove_ogg(TagLib::Ogg::XiphComment *tag) {
   tag -> removeFields(RG_STRING_UPPER[RG_REFERENCE_LOUDNESS]);
 }
 
-void tag_make_ogg(AudioFile *audio_file, bool do_album, char mode, char *unit,
-  TagLib::Ogg::XiphComment *tag) {
-
-  char value[2048];
-
+void tag_make_ogg(const rg_list &rg, TagLib::Ogg::XiphComment *tag) {
   // remove old tags before writing new ones
   tag_remove_ogg(tag);
 
-  snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-  tag -> addField(RG_STRING_UPPER[RG_TRACK_GAIN], value);
+  for (const auto &item : rg)
+    tag -> addField(item.first, TagLib::String(item.second, TagLib::String::UTF8));
+}
 
-  snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-  tag -> addField(RG_STRING_UPPER[RG_TRACK_PEAK], value);
+/*** Ogg: in-place comment updates ***/
+
+// TagLib repaginates the header packets on every save, and if the number of
+// header pages changes, it renumbers and rewrites all pages behind them.
+// If the new comment packet isn't larger than the old one, we pad it with
+// zeros to the old size instead (Vorbis, Opus and Speex all ignore data
+// behind the comment list), so the lacing values stay the same and only the
+// header page bodies and their CRCs change. Ogg FLAC stores the comment
+// length in the packet, so it is left to TagLib.
+
+static uint32_t ogg_crc(const char *data, unsigned int length) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int j = 0; j < 8; j++)
+        r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+      t[i] = r;
+    }
+    return t;
+  }();
 
-  // Only write album tags if in album mode (would be zero otherwise)
-  if (do_album) {
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-    tag -> addField(RG_STRING_UPPER[RG_ALBUM_GAIN], value);
+  uint32_t crc = 0;
+  for (unsigned int i = 0; i < length; i++)
+    crc = (crc << 8) ^ table[((crc >> 24) ^ (unsigned char) data[i]) & 0xff];
+  return crc;
+}
 
-    snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-    tag -> addField(RG_STRING_UPPER[RG_ALBUM_PEAK], value);
+// Overwrite the comment packet (packet 1) in place. False if it doesn't fit
+// or the header pages look unusual (e.g. multiplexed streams).
+static bool ogg_save_in_place(TagLib::Ogg::File &f, TagLib::ByteVector packet) {
+  std::vector<std::pair<long, unsigned int>> pieces;  // file offset, length
+  long length = f.length();
+  long pos = 0, start = -1;
+  unsigned int serial = 0, index = 0, size = 0;
+  bool done = false;
+
+  if (f.readOnly())
+    return false;
+
+  while (!done && pos + 27 <= length) {
+    f.seek(pos);
+    TagLib::ByteVector header = f.readBlock(27);
+    if (header.size() != 27 || !header.startsWith("OggS") || header[4] != 0)
+      return false;
+
+    unsigned int pageSerial = header.mid(14, 4).toUInt(false);
+    if (pos == 0)
+      serial = pageSerial;
+    else if (pageSerial != serial)
+      return false;
+
+    unsigned int segments = (unsigned char) header[26];
+    TagLib::ByteVector lacing = f.readBlock(segments);
+    if (lacing.size() != segments)
+      return false;
+
+    long data = pos + 27 + segments;
+    for (unsigned int i = 0; i < segments; i++) {
+      unsigned int l = (unsigned char) lacing[i];
+      if (index == 1) {
+        if (start < 0)
+          start = pos;
+        pieces.push_back({data, l});
+        size += l;
+      }
+      data += l;
+      if (l < 255) {
+        done = done || index == 1;
+        index++;
+      }
+    }
+    pos = data;
   }
 
-  // extra tags mode -s e or -s l
-  if (mode == 'e' || mode == 'l') {
-    snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-    tag -> addField(RG_STRING_UPPER[RG_REFERENCE_LOUDNESS], value);
+  if (!done || pos > length || packet.size() > size)
+    return false;
 
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-    tag -> addField(RG_STRING_UPPER[RG_TRACK_RANGE], value);
+  packet.resize(size, 0);
 
-    if (do_album) {
-      snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-      tag -> addField(RG_STRING_UPPER[RG_ALBUM_RANGE], value);
-    }
+  f.seek(start);
+  TagLib::ByteVector region = f.readBlock(pos - start);
+  if (long(region.size()) != pos - start)
+    return false;
+
+  unsigned int p = 0;
+  for (const auto &piece : pieces)
+    for (unsigned int i = 0; i < piece.second; i++)
+      region[piece.first - start + i] = packet[p++];
+
+  // new CRCs; the checksum field itself counts as zero
+  for (unsigned int page = 0; page < region.size(); ) {
+    unsigned int segments = (unsigned char) region[page + 26];
+    unsigned int pageLength = 27 + segments;
+    for (unsigned int i = 0; i < segments; i++)
+      pageLength += (unsigned char) region[page + 27 + i];
+
+    for (unsigned int i = 22; i < 26; i++)
+      region[page + i] = 0;
+    uint32_t crc = ogg_crc(region.data() + page, pageLength);
+    for (unsigned int i = 0; i < 4; i++)
+      region[page + 22 + i] = (char) ((crc >> (8 * i)) & 0xff);
+
+    page += pageLength;
   }
+
+  f.seek(start);
+  f.writeBlock(region);
+  return true;
+}
+
+// Save the comment packet in place if possible, else let TagLib repaginate
+// with `padding` zero bytes appended, so the next update fits.
+static bool tag_save_ogg(AudioFile *audio_file, TagLib::Ogg::File &f,
+  const TagLib::ByteVector &packet, long padding) {
+  if (ogg_save_in_place(f, packet))
+    return true;
+
+  TagLib::ByteVector padded = packet;
+  padded.resize(packet.size() + (unsigned int) padding, 0);
+  f.setPacket(1, padded);
+  audio_file->tagStatus = AudioFile::TAGSTATUS::REWRITTEN;
+
+  return f.TagLib::Ogg::File::save();
+}
+
+static TagLib::ByteVector ogg_vorbis_packet(TagLib::Ogg::XiphComment *tag) {
+  TagLib::ByteVector packet("\x03vorbis", 7);
+  packet.append(tag->render());
+  return packet;
+}
+
+static TagLib::ByteVector ogg_opus_packet(TagLib::Ogg::XiphComment *tag) {
+  TagLib::ByteVector packet("OpusTags", 8);
+  packet.append(tag->render(false));
+  return packet;
 }
 
 /*** Ogg: Ogg Vorbis ***/
 
-bool tag_write_ogg_vorbis(AudioFile *audio_file, bool do_album, char mode, char *unit) {
-  TagLib::Ogg::Vorbis::File f(audio_file->filePath.c_str());
+bool tag_write_ogg_vorbis(AudioFile *audio_file, bool do_album, char mode, char *unit,
+  long padding) {
+  rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING_UPPER);
+
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::Ogg::Vorbis::File f(stream.get(), false);
   TagLib::Ogg::XiphComment *tag = f.tag();
 
-  tag_make_ogg(audio_file, do_album, mode, unit, tag);
+  if (tag_rg_unchanged(tag_find_xiph(tag, false), rg)) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
 
-  return f.save();
+  tag_make_ogg(rg, tag);
+
+  return tag_save_ogg(audio_file, f, ogg_vorbis_packet(tag), padding);
 }
 
 bool tag_clear_ogg_vorbis(AudioFile *audio_file) {
-  TagLib::Ogg::Vorbis::File f(audio_file->filePath.c_str());
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::Ogg::Vorbis::File f(stream.get(), false);
   TagLib::Ogg::XiphComment *tag = f.tag();
 
+  if (tag_find_xiph(tag, false).empty()) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
+
   tag_remove_ogg(tag);
 
-  return f.save();
+  return tag_save_ogg(audio_file, f, ogg_vorbis_packet(tag), 0);
 }
 
 /*** Ogg: Ogg FLAC ***/
 
 bool tag_write_ogg_flac(AudioFile *audio_file, bool do_album, char mode, char *unit) {
-  TagLib::Ogg::FLAC::File f(audio_file->filePath.c_str());
+  rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING_UPPER);
+
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::Ogg::FLAC::File f(stream.get(), false);
   TagLib::Ogg::XiphComment *tag = f.tag();
 
-  tag_make_ogg(audio_file, do_album, mode, unit, tag);
+  if (tag_rg_unchanged(tag_find_xiph(tag, false), rg)) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
+
+  tag_make_ogg(rg, tag);
 
   return f.save();
 }
 
 bool tag_clear_ogg_flac(AudioFile *audio_file) {
-  TagLib::Ogg::FLAC::File f(audio_file->filePath.c_str());
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::Ogg::FLAC::File f(stream.get(), false);
   TagLib::Ogg::XiphComment *tag = f.tag();
 
+  if (tag_find_xiph(tag, false).empty()) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
+
   tag_remove_ogg(tag);
 
   return f.save();
@@ -386,22 +1079,37 @@ bool tag_clear_ogg_flac(AudioFile *audio_file) {
 
 /*** Ogg: Ogg Speex ***/
 
-bool tag_write_ogg_speex(AudioFile *audio_file, bool do_album, char mode, char *unit) {
-  TagLib::Ogg::Speex::File f(audio_file->filePath.c_str());
+bool tag_write_ogg_speex(AudioFile *audio_file, bool do_album, char mode, char *unit,
+  long padding) {
+  rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING_UPPER);
+
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::Ogg::Speex::File f(stream.get(), false);
   TagLib::Ogg::XiphComment *tag = f.tag();
 
-  tag_make_ogg(audio_file, do_album, mode, unit, tag);
+  if (tag_rg_unchanged(tag_find_xiph(tag, false), rg)) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
 
-  return f.save();
+  tag_make_ogg(rg, tag);
+
+  return tag_save_ogg(audio_file, f, tag->render(), padding);
 }
 
 bool tag_clear_ogg_speex(AudioFile *audio_file) {
-  TagLib::Ogg::Speex::File f(audio_file->filePath.c_str());
+  std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+  TagLib::Ogg::Speex::File f(stream.get(), false);
   TagLib::Ogg::XiphComment *tag = f.tag();
 
+  if (tag_find_xiph(tag, false).empty()) {
+    audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+    return true;
+  }
+
   tag_remove_ogg(tag);
 
-  return f.save();
+  return tag_save_ogg(audio_file, f, tag->render(), 0);
 }
 
 /*** Ogg: Opus ****/
@@ -456,38 +1164,55 @@ void tag_remove_ogg_opus(TagLib::Ogg::XiphComment *tag) {
     tag -> removeFields("R128_ALBUM_GAIN");
 }
 
-bool tag_write_ogg_opus(AudioFile *audio_file, bool do_album, char mode, char *unit) {
+bool tag_write_ogg_opus(AudioFile *audio_file, bool do_album, char mode, char *unit,
+  long padding) {
     UNUSED(mode); UNUSED(unit);
     char value[2048];
-
-    TagLib::Ogg::Opus::File f(audio_file->filePath.c_str());
-    TagLib::Ogg::XiphComment *tag = f.tag();
-
-    // remove old tags before writing new ones
-    tag_remove_ogg_opus(tag);
+    rg_list rg;
 
     snprintf(value, sizeof(value), "%d", gain_to_q78num(audio_file->trackGain));
-    tag -> addField("R128_TRACK_GAIN", value);
+    rg.push_back({"R128_TRACK_GAIN", value});
 
     // Only write album tags if in album mode (would be zero otherwise)
     if (do_album) {
         snprintf(value, sizeof(value), "%d", gain_to_q78num(audio_file->albumGain));
-        tag -> addField("R128_ALBUM_GAIN", value);
+        rg.push_back({"R128_ALBUM_GAIN", value});
     }
 
     // extra tags mode -s e or -s l
     // no extra tags allowed in Opus
 
-    return f.save();
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::Ogg::Opus::File f(stream.get(), false);
+    TagLib::Ogg::XiphComment *tag = f.tag();
+
+    if (tag_rg_unchanged(tag_find_xiph(tag, true), rg)) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
+    // remove old tags before writing new ones
+    tag_remove_ogg_opus(tag);
+
+    for (const auto &item : rg)
+        tag -> addField(item.first, item.second);
+
+    return tag_save_ogg(audio_file, f, ogg_opus_packet(tag), padding);
 }
 
 bool tag_clear_ogg_opus(AudioFile *audio_file) {
-    TagLib::Ogg::Opus::File f(audio_file->filePath.c_str());
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::Ogg::Opus::File f(stream.get(), false);
     TagLib::Ogg::XiphComment *tag = f.tag();
 
+    if (tag_find_xiph(tag, true).empty()) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_ogg_opus(tag);
 
-    return f.save();
+    return tag_save_ogg(audio_file, f, ogg_opus_packet(tag), 0);
 }
 
 
@@ -525,59 +1250,436 @@ void tag_remove_mp4(TagLib::MP4::Tag *tag) {
     }
 }
 
-bool tag_write_mp4(AudioFile *audio_file, bool do_album, char mode, char *unit,
-                   bool lowercase) {
-    char value[2048];
-    const char **RG_STRING = RG_STRING_UPPER;
+/*** MP4: in-place updates ***/
 
-    if (lowercase) {
-        RG_STRING = RG_STRING_LOWER;
+// TagLib only reuses "free" atoms right next to "ilst". When "moov" grows
+// otherwise and the audio ("mdat") follows it, all audio has to move and all
+// chunk offsets have to be patched. We rebuild "moov" in memory instead:
+// the RG items in "ilst" are replaced, and all free/skip atoms inside
+// moov/udta/meta and directly behind moov are collected into one "free" atom
+// after "ilst". Only if that space doesn't suffice the file grows, and then
+// by `padding` extra bytes, so the next update fits.
+
+struct mp4_atom {
+    TagLib::ByteVector name;
+    unsigned int offset;    // of the atom header, within the buffer
+    unsigned int length;    // including the 8-byte header
+};
+
+static bool mp4_is_free(const TagLib::ByteVector &name) {
+    return name == "free" || name == "skip";
+}
+
+static TagLib::ByteVector mp4_render_atom(const char *name, const TagLib::ByteVector &data) {
+    TagLib::ByteVector atom = TagLib::ByteVector::fromUInt(data.size() + 8);
+    atom.append(TagLib::ByteVector(name, 4));
+    atom.append(data);
+    return atom;
+}
+
+static void mp4_set_uint(TagLib::ByteVector &data, unsigned int offset, unsigned int value) {
+    TagLib::ByteVector v = TagLib::ByteVector::fromUInt(value);
+    for (unsigned int i = 0; i < 4; i++)
+        data[offset + i] = v[i];
+}
+
+// Split [start, end) into atoms. Up to 7 trailing bytes (QuickTime ends
+// some containers with a 32-bit zero) are tolerated and kept by the callers.
+static bool mp4_children(const TagLib::ByteVector &data, unsigned int start,
+                         unsigned int end, std::vector<mp4_atom> &atoms) {
+    atoms.clear();
+    while (start + 8 <= end) {
+        unsigned int length = data.mid(start, 4).toUInt();
+        if (length < 8 || length > end - start)
+            return false;
+        atoms.push_back({data.mid(start + 4, 4), start, length});
+        start += length;
     }
+    return true;
+}
 
-    TagLib::MP4::File f(audio_file->filePath.c_str());
-    TagLib::MP4::Tag *tag = f.tag();
+static unsigned int mp4_children_end(const std::vector<mp4_atom> &atoms, unsigned int start) {
+    return atoms.empty() ? start : atoms.back().offset + atoms.back().length;
+}
 
-    // remove old tags before writing new ones
-    tag_remove_mp4(tag);
+// "----" item with mean "com.apple.iTunes" and one of our RG names
+static bool mp4_is_rg_item(const TagLib::ByteVector &data, const mp4_atom &item) {
+    std::vector<mp4_atom> parts;
+    bool mean = false, name = false;
+
+    if (!mp4_children(data, item.offset + 8, item.offset + item.length, parts))
+        return false;
+
+    for (const mp4_atom &part : parts) {
+        if (part.length < 12)
+            continue;
+        TagLib::String text(data.mid(part.offset + 12, part.length - 12), TagLib::String::UTF8);
+        if (part.name == "mean")
+            mean = text.upper() == "COM.APPLE.ITUNES";
+        else if (part.name == "name")
+            name = tag_is_rg(text.upper());
+    }
 
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-    tag -> setItem(tagname(RG_STRING[RG_TRACK_GAIN]), TagLib::StringList(value));
+    return mean && name;
+}
 
-    snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-    tag -> setItem(tagname(RG_STRING[RG_TRACK_PEAK]), TagLib::StringList(value));
+static TagLib::ByteVector mp4_render_freeform(const std::string &name, const std::string &value) {
+    TagLib::ByteVector mean = TagLib::ByteVector::fromUInt(0);
+    mean.append("com.apple.iTunes");
+    TagLib::ByteVector key = TagLib::ByteVector::fromUInt(0);
+    key.append(TagLib::ByteVector(name.data(), (unsigned int) name.size()));
+    TagLib::ByteVector text = TagLib::ByteVector::fromUInt(1);   // UTF-8
+    text.append(TagLib::ByteVector::fromUInt(0));                // locale
+    text.append(TagLib::ByteVector(value.data(), (unsigned int) value.size()));
+
+    TagLib::ByteVector item = mp4_render_atom("mean", mean);
+    item.append(mp4_render_atom("name", key));
+    item.append(mp4_render_atom("data", text));
+    return mp4_render_atom("----", item);
+}
 
-    // Only write album tags if in album mode (would be zero otherwise)
-    if (do_album) {
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-        tag -> setItem(tagname(RG_STRING[RG_ALBUM_GAIN]), TagLib::StringList(value));
+// ilst with the kept `items` and the RG items, then `freeSize` bytes of "free"
+static TagLib::ByteVector mp4_render_ilst(const TagLib::ByteVector &items, const rg_list &rg,
+                                          unsigned int freeSize) {
+    TagLib::ByteVector ilstData = items;
+
+    for (const auto &item : rg)
+        ilstData.append(mp4_render_freeform(item.first, item.second));
+
+    TagLib::ByteVector data = mp4_render_atom("ilst", ilstData);
+    if (freeSize >= 8)
+        data.append(mp4_render_atom("free", TagLib::ByteVector(freeSize - 8, 0)));
+    return data;
+}
+
+// iTunes metadata: "meta" (a full atom) with an "mdir" handler, as TagLib writes it
+static TagLib::ByteVector mp4_render_meta(const rg_list &rg, unsigned int freeSize) {
+    TagLib::ByteVector hdlr(8, 0);
+    hdlr.append(TagLib::ByteVector("mdirappl"));
+    hdlr.append(TagLib::ByteVector(9, 0));
+
+    TagLib::ByteVector metaData(4, 0);
+    metaData.append(mp4_render_atom("hdlr", hdlr));
+    metaData.append(mp4_render_ilst(TagLib::ByteVector(), rg, freeSize));
+    return mp4_render_atom("meta", metaData);
+}
+
+// meta whose "hdlr" says iTunes metadata ("mdir")
+static bool mp4_is_mdir(const TagLib::ByteVector &moov, const std::vector<mp4_atom> &metaChildren) {
+    for (const mp4_atom &hdlr : metaChildren)
+        if (hdlr.name == "hdlr")
+            return hdlr.length >= 20 && moov.mid(hdlr.offset + 16, 4) == "mdir";
+    return false;
+}
+
+// Rebuild moov: new ilst, free/skip atoms along moov/udta/meta dropped, and
+// `freeSize` bytes (0 or >= 8) of "free" after ilst. A missing udta, meta or
+// ilst is created (freshly encoded files have none), if there are items to
+// write. False if moov's metadata doesn't have the usual layout.
+static bool mp4_rebuild_moov(const TagLib::ByteVector &moov, const rg_list &rg,
+                             unsigned int freeSize, TagLib::ByteVector &result) {
+    std::vector<mp4_atom> moovChildren, udtaChildren, metaChildren, items;
+    TagLib::ByteVector moovData, udtaData, metaData, ilstData;
+    bool found = false, udtaSeen = false;
+
+    if (!mp4_children(moov, 8, moov.size(), moovChildren))
+        return false;
+
+    for (const mp4_atom &udta : moovChildren) {
+        if (mp4_is_free(udta.name))
+            continue;
+        if (udta.name != "udta" || found || udtaSeen) {
+            moovData.append(moov.mid(udta.offset, udta.length));
+            continue;
+        }
+
+        bool metaSeen = false;
+        udtaSeen = true;
+        udtaData.clear();
+        if (!mp4_children(moov, udta.offset + 8, udta.offset + udta.length, udtaChildren))
+            return false;
+
+        for (const mp4_atom &meta : udtaChildren) {
+            if (mp4_is_free(meta.name))
+                continue;
+            if (meta.name != "meta" || found || meta.length < 12) {
+                metaSeen = metaSeen || meta.name == "meta";
+                udtaData.append(moov.mid(meta.offset, meta.length));
+                continue;
+            }
+            metaSeen = true;
+
+            // "meta" is a full atom: version and flags come first
+            metaData.clear();
+            metaData.append(moov.mid(meta.offset + 8, 4));
+            if (!mp4_children(moov, meta.offset + 12, meta.offset + meta.length, metaChildren))
+                return false;
+
+            for (const mp4_atom &ilst : metaChildren) {
+                if (mp4_is_free(ilst.name))
+                    continue;
+                if (ilst.name != "ilst" || found) {
+                    metaData.append(moov.mid(ilst.offset, ilst.length));
+                    continue;
+                }
+
+                if (!mp4_children(moov, ilst.offset + 8, ilst.offset + ilst.length, items))
+                    return false;
+
+                ilstData.clear();
+                for (const mp4_atom &item : items)
+                    if (item.name != "----" || !mp4_is_rg_item(moov, item))
+                        ilstData.append(moov.mid(item.offset, item.length));
+
+                metaData.append(mp4_render_ilst(ilstData, rg, freeSize));
+                found = true;
+            }
+            if (!found && !rg.empty() && mp4_is_mdir(moov, metaChildren)) {
+                metaData.append(mp4_render_ilst(TagLib::ByteVector(), rg, freeSize));
+                found = true;
+            }
+            unsigned int metaEnd = meta.offset + meta.length;
+            unsigned int metaLast = mp4_children_end(metaChildren, meta.offset + 12);
+            metaData.append(moov.mid(metaLast, metaEnd - metaLast));
+
+            if (found)
+                udtaData.append(mp4_render_atom("meta", metaData));
+            else
+                udtaData.append(moov.mid(meta.offset, meta.length));
+        }
+        if (!found && !metaSeen && !rg.empty()) {
+            udtaData.append(mp4_render_meta(rg, freeSize));
+            found = true;
+        }
+        unsigned int udtaEnd = udta.offset + udta.length;
+        unsigned int udtaLast = mp4_children_end(udtaChildren, udta.offset + 8);
+        udtaData.append(moov.mid(udtaLast, udtaEnd - udtaLast));
+
+        if (found)
+            moovData.append(mp4_render_atom("udta", udtaData));
+        else
+            moovData.append(moov.mid(udta.offset, udta.length));
+    }
+    if (!found && !udtaSeen && !rg.empty()) {
+        moovData.append(mp4_render_atom("udta", mp4_render_meta(rg, freeSize)));
+        found = true;
+    }
+    unsigned int moovLast = mp4_children_end(moovChildren, 8);
+    moovData.append(moov.mid(moovLast, moov.size() - moovLast));
+
+    result = mp4_render_atom("moov", moovData);
+    return found;
+}
+
+// Shift all chunk offsets (stco/co64) at or behind `from` by `delta`.
+static bool mp4_update_offsets(TagLib::ByteVector &moov, unsigned int start, unsigned int end,
+                               long long from, long long delta) {
+    std::vector<mp4_atom> atoms;
 
-        snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-        tag -> setItem(tagname(RG_STRING[RG_ALBUM_PEAK]), TagLib::StringList(value));
+    if (!mp4_children(moov, start, end, atoms))
+        return false;
+
+    for (const mp4_atom &atom : atoms) {
+        if (atom.name == "trak" || atom.name == "mdia" || atom.name == "minf" || atom.name == "stbl") {
+            if (!mp4_update_offsets(moov, atom.offset + 8, atom.offset + atom.length, from, delta))
+                return false;
+        }
+        else if (atom.name == "stco" || atom.name == "co64") {
+            unsigned int size = atom.name == "stco" ? 4 : 8;
+            if (atom.length < 16)
+                return false;
+            unsigned int count = moov.mid(atom.offset + 12, 4).toUInt();
+            if ((unsigned long long) count * size > atom.length - 16)
+                return false;
+
+            for (unsigned int i = 0; i < count; i++) {
+                unsigned int at = atom.offset + 16 + i * size;
+                if (size == 4) {
+                    long long offset = moov.mid(at, 4).toUInt();
+                    if (offset < from)
+                        continue;
+                    if (offset + delta > 0xffffffffLL)
+                        return false;
+                    mp4_set_uint(moov, at, (unsigned int) (offset + delta));
+                } else {
+                    long long offset = moov.mid(at, 8).toLongLong();
+                    if (offset < from)
+                        continue;
+                    offset += delta;
+                    mp4_set_uint(moov, at, (unsigned int) (offset >> 32));
+                    mp4_set_uint(moov, at + 4, (unsigned int) (offset & 0xffffffff));
+                }
+            }
+        }
     }
 
-    // extra tags mode -s e or -s l
-    if (mode == 'e' || mode == 'l') {
-        snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-        tag -> setItem(tagname(RG_STRING[RG_REFERENCE_LOUDNESS]), TagLib::StringList(value));
+    return true;
+}
+
+// Returns 1 on success, 0 on failure and -1 if TagLib should save instead.
+static int tag_save_mp4(AudioFile *audio_file, TagLib::MP4::File &f, const rg_list &rg, long padding) {
+    if (f.readOnly())
+        return -1;
+
+    // find moov, the free/skip atoms directly behind it, and what follows
+    long length = f.length();
+    long pos = 0, moovOffset = -1, moovLength = 0, spare = 0;
+    bool after = false;
+    while (pos + 8 <= length) {
+        f.seek(pos);
+        TagLib::ByteVector header = f.readBlock(8);
+        if (header.size() != 8)
+            return -1;
+        TagLib::ByteVector name = header.mid(4, 4);
+        long long size = header.mid(0, 4).toUInt();
+        bool large = size == 1;
+        if (large)
+            size = f.readBlock(8).toLongLong();
+        else if (size == 0)
+            size = length - pos;
+        if (size < 8 || size > length - pos)
+            return -1;
+
+        // fragmented files have more offsets than we care to patch
+        if (name == "moof")
+            return -1;
+
+        if (name == "moov") {
+            if (moovOffset >= 0 || large || size > 64 * 1024 * 1024)
+                return -1;
+            moovOffset = pos;
+            moovLength = long(size);
+        }
+        else if (moovOffset >= 0 && !after && mp4_is_free(name))
+            spare += long(size);
+        else if (moovOffset >= 0)
+            after = true;
+
+        pos += long(size);
+    }
+    if (moovOffset < 0)
+        return -1;
+
+    f.seek(moovOffset);
+    TagLib::ByteVector moov = f.readBlock(moovLength);
+    if (long(moov.size()) != moovLength)
+        return -1;
+
+    // all frees are dropped during the rebuild, they're in `available` now
+    TagLib::ByteVector result;
+    if (!mp4_rebuild_moov(moov, rg, 0, result))
+        return -1;
+    unsigned long available = (unsigned long) (moovLength + spare);
+    unsigned long needed = result.size();
+
+    if (needed == available || needed + 8 <= available) {
+        if (needed != available)
+            mp4_rebuild_moov(moov, rg, (unsigned int) (available - needed), result);
+        f.seek(moovOffset);
+        f.writeBlock(result);
+        return 1;
+    }
+
+    // Doesn't fit: grow, with reserve. If the audio follows, it moves, so
+    // the chunk offsets pointing there have to move, too.
+    unsigned int freeSize = 8 + (unsigned int) padding;
+    long long delta = (long long) (needed + freeSize) - (long long) available;
+    if (after) {
+        if (!mp4_update_offsets(moov, 8, moov.size(), moovOffset + (long long) available, delta))
+            return -1;
+        audio_file->tagStatus = AudioFile::TAGSTATUS::REWRITTEN;
+    }
+
+    if (!mp4_rebuild_moov(moov, rg, freeSize, result))
+        return -1;
+    f.insert(result, moovOffset, available);
+    return 1;
+}
 
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-        tag -> setItem(tagname(RG_STRING[RG_TRACK_RANGE]), TagLib::StringList(value));
+static rg_found tag_find_mp4(TagLib::MP4::Tag *tag) {
+    rg_found found;
+#if TAGLIB_VERSION >= 11200
+    TagLib::MP4::ItemMap items = tag->itemMap();
 
-        if (do_album) {
-            snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-            tag -> setItem(tagname(RG_STRING[RG_ALBUM_RANGE]), TagLib::StringList(value));
+    for(TagLib::MP4::ItemMap::Iterator item = items.begin();
+        item != items.end(); ++item)
+#else
+    TagLib::MP4::ItemListMap &items = tag->itemListMap();
+
+    for(TagLib::MP4::ItemListMap::Iterator item = items.begin();
+        item != items.end(); ++item)
+#endif
+    {
+        TagLib::String desc = item->first.upper();
+        if (!desc.startsWith(tagname("").upper()))
+            continue;
+        if (tag_is_rg(desc.substr(tagname("").size()))) {
+            std::vector<std::string> &values = found[item->first.to8Bit(true)];
+            TagLib::StringList list = item->second.toStringList();
+            for (TagLib::StringList::ConstIterator v = list.begin(); v != list.end(); ++v)
+                values.push_back(v->to8Bit(true));
         }
     }
 
+    return found;
+}
+
+bool tag_write_mp4(AudioFile *audio_file, bool do_album, char mode, char *unit,
+                   bool lowercase, long padding) {
+    const char **RG_STRING = RG_STRING_UPPER;
+
+    if (lowercase) {
+        RG_STRING = RG_STRING_LOWER;
+    }
+
+    rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
+    for (auto &item : rg)
+        item.first = tagname(item.first).to8Bit(true);
+
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::MP4::File f(stream.get(), false);
+    TagLib::MP4::Tag *tag = f.tag();
+
+    if (tag_rg_unchanged(tag_find_mp4(tag), rg)) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
+    // remove old tags before writing new ones
+    tag_remove_mp4(tag);
+
+    for (const auto &item : rg)
+        tag -> setItem(TagLib::String(item.first, TagLib::String::UTF8),
+                       TagLib::StringList(TagLib::String(item.second, TagLib::String::UTF8)));
+
+    // our own writer wants the bare item names
+    for (auto &item : rg)
+        item.first = item.first.substr(strlen(RG_ATOM));
+
+    int rc = tag_save_mp4(audio_file, f, rg, padding);
+    if (rc >= 0)
+        return rc == 1;
+
     return f.save();
 }
 
-bool tag_clear_mp4(AudioFile *audio_file) {
-    TagLib::MP4::File f(audio_file->filePath.c_str());
+bool tag_clear_mp4(AudioFile *audio_file, long padding) {
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::MP4::File f(stream.get(), false);
     TagLib::MP4::Tag *tag = f.tag();
 
+    if (tag_find_mp4(tag).empty()) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_mp4(tag);
 
+    // removing only shrinks moov; the reserve is for leftovers under 8 bytes
+    int rc = tag_save_mp4(audio_file, f, rg_list(), std::max(padding, 8L));
+    if (rc >= 0)
+        return rc == 1;
+
     return f.save();
 }
 
@@ -603,57 +1705,61 @@ void tag_remove_asf(TagLib::ASF::Tag *tag) {
     }
 }
 
+static rg_found tag_find_asf(TagLib::ASF::Tag *tag) {
+    rg_found found;
+    TagLib::ASF::AttributeListMap &items = tag->attributeListMap();
+
+    for(TagLib::ASF::AttributeListMap::Iterator item = items.begin();
+        item != items.end(); ++item)
+    {
+        if (tag_is_rg(item->first.upper())) {
+            std::vector<std::string> &values = found[item->first.to8Bit(true)];
+            for (TagLib::ASF::AttributeList::ConstIterator v = item->second.begin(); v != item->second.end(); ++v)
+                values.push_back(v->toString().to8Bit(true));
+        }
+    }
+
+    return found;
+}
+
 bool tag_write_asf(AudioFile *audio_file, bool do_album, char mode, char *unit,
                    bool lowercase) {
-    char value[2048];
     const char **RG_STRING = RG_STRING_UPPER;
 
     if (lowercase) {
         RG_STRING = RG_STRING_LOWER;
     }
 
-    TagLib::ASF::File f(audio_file->filePath.c_str());
-    TagLib::ASF::Tag *tag = f.tag();
-
-    // remove old tags before writing new ones
-    tag_remove_asf(tag);
+    rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
 
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-    tag -> setAttribute(RG_STRING[RG_TRACK_GAIN], TagLib::String(value));
-
-    snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-    tag -> setAttribute(RG_STRING[RG_TRACK_PEAK], TagLib::String(value));
-
-    // Only write album tags if in album mode (would be zero otherwise)
-    if (do_album) {
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-        tag -> setAttribute(RG_STRING[RG_ALBUM_GAIN], TagLib::String(value));
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::ASF::File f(stream.get(), false);
+    TagLib::ASF::Tag *tag = f.tag();
 
-        snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-        tag -> setAttribute(RG_STRING[RG_ALBUM_PEAK], TagLib::String(value));
+    if (tag_rg_unchanged(tag_find_asf(tag), rg)) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
     }
 
-    // extra tags mode -s e or -s l
-    if (mode == 'e' || mode == 'l') {
-        snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-        tag -> setAttribute(RG_STRING[RG_REFERENCE_LOUDNESS], TagLib::String(value));
-
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-        tag -> setAttribute(RG_STRING[RG_TRACK_RANGE], TagLib::String(value));
+    // remove old tags before writing new ones
+    tag_remove_asf(tag);
 
-        if (do_album) {
-            snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-            tag -> setAttribute(RG_STRING[RG_ALBUM_RANGE], TagLib::String(value));
-        }
-    }
+    for (const auto &item : rg)
+        tag -> setAttribute(item.first.c_str(), TagLib::String(item.second, TagLib::String::UTF8));
 
     return f.save();
 }
 
 bool tag_clear_asf(AudioFile *audio_file) {
-    TagLib::ASF::File f(audio_file->filePath.c_str());
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::ASF::File f(stream.get(), false);
     TagLib::ASF::Tag *tag = f.tag();
 
+    if (tag_find_asf(tag).empty()) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_asf(tag);
 
     return f.save();
@@ -689,51 +1795,37 @@ void tag_remove_wav(TagLib::ID3v2::Tag *tag) {
 
 // Experimental WAV file tagging within an "ID3 " chunk
 bool tag_write_wav(AudioFile *audio_file, bool do_album, char mode, char *unit,
-                   bool lowercase, bool strip, int id3v2version) {
+                   bool lowercase, bool strip, int id3v2version, long padding) {
     UNUSED(strip);
-    char value[2048];
     const char **RG_STRING = RG_STRING_UPPER;
 
     if (lowercase) {
         RG_STRING = RG_STRING_LOWER;
     }
 
-    TagLib::RIFF::WAV::File f(audio_file->filePath.c_str());
-    TagLib::ID3v2::Tag *tag = f.ID3v2Tag();
+    rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
 
-    // remove old tags before writing new ones
-    tag_remove_wav(tag);
-
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_GAIN]), value);
-
-    snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_PEAK]), value);
-
-    // Only write album tags if in album mode (would be zero otherwise)
-    if (do_album) {
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_GAIN]), value);
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    ID3ChunkFile<TagLib::RIFF::WAV::File> f(stream.get(), false);
+    TagLib::ID3v2::Tag *tag = f.ID3v2Tag();
 
-        snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_PEAK]), value);
+    if (tag_rg_unchanged(tag_find_id3v2(tag), rg)
+        && int(tag -> header() -> majorVersion()) == id3v2version) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
     }
 
-    // extra tags mode -s e or -s l
-    if (mode == 'e' || mode == 'l') {
-        snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_REFERENCE_LOUDNESS]), value);
-
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_RANGE]), value);
+    // remove old tags before writing new ones
+    tag_remove_wav(tag);
 
-        if (do_album) {
-            snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-            tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_RANGE]), value);
-        }
-    }
+    for (const auto &item : rg)
+        tag_add_txxx(tag, item.first.c_str(), item.second.c_str());
 
     // no stripping
+    int rc = f.saveID3v2(audio_file, tag, id3v2version, padding);
+    if (rc >= 0)
+        return rc == 1;
+
 #if TAGLIB_VERSION >= 11200
     return f.save(TagLib::RIFF::WAV::File::AllTags,
                   TagLib::RIFF::WAV::File::StripNone,
@@ -745,12 +1837,22 @@ bool tag_write_wav(AudioFile *audio_file, bool do_album, char mode, char *unit,
 
 bool tag_clear_wav(AudioFile *audio_file, bool strip, int id3v2version) {
     UNUSED(strip);
-    TagLib::RIFF::WAV::File f(audio_file->filePath.c_str());
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    ID3ChunkFile<TagLib::RIFF::WAV::File> f(stream.get(), false);
     TagLib::ID3v2::Tag *tag = f.ID3v2Tag();
 
+    if (tag_find_id3v2(tag).empty()) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_wav(tag);
 
     // no stripping
+    int rc = f.saveID3v2(audio_file, tag, id3v2version, 0);
+    if (rc >= 0)
+        return rc == 1;
+
 #if TAGLIB_VERSION >= 11200
     return f.save(TagLib::RIFF::WAV::File::AllTags,
                   TagLib::RIFF::WAV::File::StripNone,
@@ -792,51 +1894,37 @@ void tag_remove_aiff(TagLib::ID3v2::Tag *tag) {
 
 // Experimental AIFF file tagging within an "ID3 " chunk
 bool tag_write_aiff(AudioFile *audio_file, bool do_album, char mode, char *unit,
-                    bool lowercase, bool strip, int id3v2version) {
+                    bool lowercase, bool strip, int id3v2version, long padding) {
     UNUSED(strip);
-    char value[2048];
     const char **RG_STRING = RG_STRING_UPPER;
 
     if (lowercase) {
         RG_STRING = RG_STRING_LOWER;
     }
 
-    TagLib::RIFF::AIFF::File f(audio_file->filePath.c_str());
-    TagLib::ID3v2::Tag *tag = f.tag();
+    rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
 
-    // remove old tags before writing new ones
-    tag_remove_aiff(tag);
-
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_GAIN]), value);
-
-    snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-    tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_PEAK]), value);
-
-    // Only write album tags if in album mode (would be zero otherwise)
-    if (do_album) {
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_GAIN]), value);
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    ID3ChunkFile<TagLib::RIFF::AIFF::File> f(stream.get(), false);
+    TagLib::ID3v2::Tag *tag = f.tag();
 
-        snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_PEAK]), value);
+    if (tag_rg_unchanged(tag_find_id3v2(tag), rg)
+        && int(tag -> header() -> majorVersion()) == id3v2version) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
     }
 
-    // extra tags mode -s e or -s l
-    if (mode == 'e' || mode == 'l') {
-        snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_REFERENCE_LOUDNESS]), value);
-
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-        tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_TRACK_RANGE]), value);
+    // remove old tags before writing new ones
+    tag_remove_aiff(tag);
 
-        if (do_album) {
-            snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-            tag_add_txxx(tag, const_cast<char *>(RG_STRING[RG_ALBUM_RANGE]), value);
-        }
-    }
+    for (const auto &item : rg)
+        tag_add_txxx(tag, item.first.c_str(), item.second.c_str());
 
     // no stripping
+    int rc = f.saveID3v2(audio_file, tag, id3v2version, padding);
+    if (rc >= 0)
+        return rc == 1;
+
 #if TAGLIB_VERSION >= 11200
     return f.save(id3v2version == 3 ? TagLib::ID3v2::v3 : TagLib::ID3v2::v4);
 #else
@@ -846,12 +1934,22 @@ bool tag_write_aiff(AudioFile *audio_file, bool do_album, char mode, char *unit,
 
 bool tag_clear_aiff(AudioFile *audio_file, bool strip, int id3v2version) {
     UNUSED(strip);
-    TagLib::RIFF::AIFF::File f(audio_file->filePath.c_str());
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    ID3ChunkFile<TagLib::RIFF::AIFF::File> f(stream.get(), false);
     TagLib::ID3v2::Tag *tag = f.tag();
 
+    if (tag_find_id3v2(tag).empty()) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_aiff(tag);
 
     // no stripping
+    int rc = f.saveID3v2(audio_file, tag, id3v2version, 0);
+    if (rc >= 0)
+        return rc == 1;
+
 #if TAGLIB_VERSION >= 11200
     return f.save(id3v2version == 3 ? TagLib::ID3v2::v3 : TagLib::ID3v2::v4);
 #else
@@ -879,10 +1977,28 @@ void tag_remove_wavpack(TagLib::APE::Tag *tag) {
     tag -> removeItem(RG_STRING_UPPER[RG_REFERENCE_LOUDNESS]);
 }
 
+// APE item keys are always stored uppercase
+static rg_found tag_find_ape(TagLib::APE::Tag *tag) {
+    rg_found found;
+    const TagLib::APE::ItemListMap &items = tag->itemListMap();
+
+    for(TagLib::APE::ItemListMap::ConstIterator item = items.begin();
+        item != items.end(); ++item)
+    {
+        if (tag_is_rg(item->first.upper())) {
+            std::vector<std::string> &values = found[item->first.to8Bit(true)];
+            TagLib::StringList list = item->second.values();
+            for (TagLib::StringList::ConstIterator v = list.begin(); v != list.end(); ++v)
+                values.push_back(v->to8Bit(true));
+        }
+    }
+
+    return found;
+}
+
 bool tag_write_wavpack(AudioFile *audio_file, bool do_album, char mode, char *unit,
                        bool lowercase, bool strip) {
     UNUSED(lowercase);
-    char value[2048];
     const char **RG_STRING = RG_STRING_UPPER;
 
     // ignore lowercase for now: CAN be written but keys should be read case-insensitively
@@ -890,40 +2006,22 @@ bool tag_write_wavpack(AudioFile *audio_file, bool do_album, char mode, char *un
     //   RG_STRING = RG_STRING_LOWER;
     // }
 
-    TagLib::WavPack::File f(audio_file->filePath.c_str());
-    TagLib::APE::Tag *tag = f.APETag(true); // create if none exists
-
-    // remove old tags before writing new ones
-    tag_remove_wavpack(tag);
-
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-    tag -> addValue(RG_STRING[RG_TRACK_GAIN], TagLib::String(value), true);
+    rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
 
-    snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-    tag -> addValue(RG_STRING[RG_TRACK_PEAK], TagLib::String(value), true);
-
-    // Only write album tags if in album mode (would be zero otherwise)
-    if (do_album) {
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-        tag -> addValue(RG_STRING[RG_ALBUM_GAIN], TagLib::String(value), true);
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::WavPack::File f(stream.get(), false);
+    TagLib::APE::Tag *tag = f.APETag(true); // create if none exists
 
-        snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-        tag -> addValue(RG_STRING[RG_ALBUM_PEAK], TagLib::String(value), true);
+    if (tag_rg_unchanged(tag_find_ape(tag), rg) && !(strip && f.hasID3v1Tag())) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
     }
 
-    // extra tags mode -s e or -s l
-    if (mode == 'e' || mode == 'l') {
-        snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-        tag -> addValue(RG_STRING[RG_REFERENCE_LOUDNESS], TagLib::String(value), true);
+    // remove old tags before writing new ones
+    tag_remove_wavpack(tag);
 
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-        tag -> addValue(RG_STRING[RG_TRACK_RANGE], TagLib::String(value), true);
-
-        if (do_album) {
-            snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-            tag -> addValue(RG_STRING[RG_ALBUM_RANGE], TagLib::String(value), true);
-        }
-    }
+    for (const auto &item : rg)
+        tag -> addValue(item.first.c_str(), TagLib::String(item.second, TagLib::String::UTF8), true);
 
     if (strip)
         f.strip(TagLib::WavPack::File::TagTypes::ID3v1);
@@ -933,9 +2031,15 @@ bool tag_write_wavpack(AudioFile *audio_file, bool do_album, char mode, char *un
 
 bool tag_clear_wavpack(AudioFile *audio_file, bool strip) {
 
-    TagLib::WavPack::File f(audio_file->filePath.c_str());
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::WavPack::File f(stream.get(), false);
     TagLib::APE::Tag *tag = f.APETag(true); // create if none exists
 
+    if (tag_find_ape(tag).empty() && !(strip && f.hasID3v1Tag())) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_wavpack(tag);
 
     if (strip)
@@ -967,7 +2071,6 @@ void tag_remove_ape(TagLib::APE::Tag *tag) {
 bool tag_write_ape(AudioFile *audio_file, bool do_album, char mode, char *unit,
                    bool lowercase, bool strip) {
     UNUSED(lowercase);
-    char value[2048];
     const char **RG_STRING = RG_STRING_UPPER;
 
     // ignore lowercase for now: CAN be written but keys should be read case-insensitively
@@ -975,40 +2078,22 @@ bool tag_write_ape(AudioFile *audio_file, bool do_album, char mode, char *unit,
     //   RG_STRING = RG_STRING_LOWER;
     // }
 
-    TagLib::APE::File f(audio_file->filePath.c_str());
-    TagLib::APE::Tag *tag = f.APETag(true); // create if none exists
-
-    // remove old tags before writing new ones
-    tag_remove_ape(tag);
-
-    snprintf(value, sizeof(value), "%.2f %s", audio_file->trackGain, unit);
-    tag -> addValue(RG_STRING[RG_TRACK_GAIN], TagLib::String(value), true);
-
-    snprintf(value, sizeof(value), "%.6f", audio_file->trackPeak);
-    tag -> addValue(RG_STRING[RG_TRACK_PEAK], TagLib::String(value), true);
+    rg_list rg = tag_make_rg_list(audio_file, do_album, mode, unit, RG_STRING);
 
-    // Only write album tags if in album mode (would be zero otherwise)
-    if (do_album) {
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->albumGain, unit);
-        tag -> addValue(RG_STRING[RG_ALBUM_GAIN], TagLib::String(value), true);
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::APE::File f(stream.get(), false);
+    TagLib::APE::Tag *tag = f.APETag(true); // create if none exists
 
-        snprintf(value, sizeof(value), "%.6f", audio_file->albumPeak);
-        tag -> addValue(RG_STRING[RG_ALBUM_PEAK], TagLib::String(value), true);
+    if (tag_rg_unchanged(tag_find_ape(tag), rg) && !(strip && f.hasID3v1Tag())) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
     }
 
-    // extra tags mode -s e or -s l
-    if (mode == 'e' || mode == 'l') {
-        snprintf(value, sizeof(value), "%.2f LUFS", audio_file->loudnessReference);
-        tag -> addValue(RG_STRING[RG_REFERENCE_LOUDNESS], TagLib::String(value), true);
+    // remove old tags before writing new ones
+    tag_remove_ape(tag);
 
-        snprintf(value, sizeof(value), "%.2f %s", audio_file->trackLoudness, unit);
-        tag -> addValue(RG_STRING[RG_TRACK_RANGE], TagLib::String(value), true);
-
-        if (do_album) {
-            snprintf(value, sizeof(value), "%.2f %s", audio_file->albumLoudnessRange, unit);
-            tag -> addValue(RG_STRING[RG_ALBUM_RANGE], TagLib::String(value), true);
-        }
-    }
+    for (const auto &item : rg)
+        tag -> addValue(item.first.c_str(), TagLib::String(item.second, TagLib::String::UTF8), true);
 
     if (strip)
         f.strip(TagLib::APE::File::TagTypes::ID3v1);
@@ -1018,9 +2103,15 @@ bool tag_write_ape(AudioFile *audio_file, bool do_album, char mode, char *unit,
 
 bool tag_clear_ape(AudioFile *audio_file, bool strip) {
 
-    TagLib::WavPack::File f(audio_file->filePath.c_str());
+    std::unique_ptr<TagLib::IOStream> stream = tag_open(audio_file);
+    TagLib::WavPack::File f(stream.get(), false);
     TagLib::APE::Tag *tag = f.APETag(true); // create if none exists
 
+    if (tag_find_ape(tag).empty() && !(strip && f.hasID3v1Tag())) {
+        audio_file->tagStatus = AudioFile::TAGSTATUS::UNCHANGED;
+        return true;
+    }
+
     tag_remove_ape(tag);
 
     if (strip)
@@ -0,0 +1,155 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iostream>
+#include <algorithm>
+#include <inttypes.h>
+#include <trace.hpp>
+#include <profile.hpp>
+#include <scan.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+Trace::~Trace()
+{
+    close();
+}
+
+bool Trace::open(const std::string &path, int threads)
+{
+    if (file != NULL)
+        return true;
+
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        std::cerr << "Failed to open file: '" << path << "'" << std::endl;
+        return false;
+    }
+
+    buffers = std::vector<Buffer>(std::max<int>(1, threads));
+    origin = Profile::now();
+    return true;
+}
+
+void Trace::add(const char *name, int fileId, uint64_t begin, uint64_t end, std::string args)
+{
+    if (file == NULL)
+        return;
+
+#ifdef _OPENMP
+    Buffer &b = buffers[size_t(omp_get_thread_num()) % buffers.size()];
+#else
+    Buffer &b = buffers[0];
+#endif
+    b.events.push_back(Event{name, fileId, begin, end, std::move(args)});
+}
+
+void Trace::addFile(const char *name, const AudioFile &audio_file, uint64_t begin)
+{
+    if (file != NULL)
+        add(name, audio_file.fileId, begin, Profile::now(), "\"path\":" + quote(audio_file.filePath));
+}
+
+std::string Trace::quote(const std::string &s)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string out = "\"";
+
+    for (unsigned char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += char(c);
+        }
+        else if (c < 0x20)
+        {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+        else
+            out += char(c);
+    }
+    return out + '"';
+}
+
+// complete ("X") events in microseconds, one track per worker
+void Trace::close()
+{
+    if (file == NULL)
+        return;
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    char buf[256];
+    bool ok = true;
+
+    for (size_t tid = 0; tid < buffers.size(); tid++)
+    {
+        snprintf(buf, sizeof(buf),
+                 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}",
+                 tid, tid);
+        out += (tid > 0) ? ",\n" : "";
+        out += buf;
+
+        for (const Event &e : buffers[tid].events)
+        {
+            uint64_t begin = e.begin > origin ? e.begin - origin : 0;
+            uint64_t dur = e.end > e.begin ? e.end - e.begin : 0;
+
+            snprintf(buf, sizeof(buf),
+                     ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,\"args\":{\"file\":%d",
+                     e.name, tid, begin / 1000, unsigned(begin % 1000), dur / 1000, unsigned(dur % 1000), e.fileId);
+            out += buf;
+            if (!e.args.empty())
+            {
+                out += ',';
+                out += e.args;
+            }
+            out += "}}";
+
+            if (out.size() >= 1024 * 1024)
+            {
+                ok = fwrite(out.data(), 1, out.size(), file) == out.size() && ok;
+                out.clear();
+            }
+        }
+    }
+
+    out += "\n]}\n";
+    ok = fwrite(out.data(), 1, out.size(), file) == out.size() && ok;
+    if (fclose(file) != 0 || !ok)
+        std::cerr << "Couldn't write the trace file" << std::endl;
+
+    file = NULL;
+    buffers.clear();
+}
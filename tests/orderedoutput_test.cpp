@@ -0,0 +1,79 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// OrderedOutput: held up slots that are spilled to disk and read back
+// must leave the memory accounting where it started.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+#include <orderedoutput.hpp>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+int main()
+{
+    std::ostringstream csv;
+    OrderedOutput output;
+
+    // no memory to spare: every held up slot goes to disk
+    output.open(&csv, 0);
+
+    output.add(1, OrderedOutput::STREAM_CSV, "track 2\n");
+    output.complete(1);
+    check(output.bufferedBytes() == 0, "spilled slot still counted as buffered");
+
+    output.add(0, OrderedOutput::STREAM_CSV, "track 1\n");
+    check(output.bufferedBytes() == 8, "slot in memory not counted");
+    output.complete(0);
+    check(output.bufferedBytes() == 0, "buffered not back to 0 after unspill");
+    check(csv.str() == "track 1\ntrack 2\n", "records out of order");
+
+    // later out-of-order completions must still find the accounting intact
+    output.add(3, OrderedOutput::STREAM_CSV, "track 4\n");
+    output.complete(3);
+    output.add(2, OrderedOutput::STREAM_CSV, "track 3\n");
+    output.complete(2);
+    check(output.bufferedBytes() == 0, "buffered not back to 0 after second unspill");
+    check(csv.str() == "track 1\ntrack 2\ntrack 3\ntrack 4\n", "records out of order");
+
+    output.close();
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,318 @@
+/*
+ * Loudness normalizer based on the EBU R128 standard
+ *
+ * Copyright (c) 2014, Alessandro Ghedini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+// loudgain-dump: converts loudgain's binary result file (-b) to CSV or JSON Lines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <charconv>
+#include <string>
+#include <vector>
+#include <resultformat.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The whole file, mapped where we can, read into memory where we can't
+class Mapping
+{
+public:
+    Mapping(const char *path)
+    {
+#ifndef _WIN32
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+
+        if (fd < 0)
+            return;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+                data = static_cast<const char *>(p);
+                size = size_t(st.st_size);
+                mapped = true;
+            }
+        }
+        close(fd);
+        if (mapped)
+            return;
+#endif
+        FILE *f = fopen(path, "rb");
+        char chunk[65536];
+        size_t n;
+
+        if (f == NULL)
+            return;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            buffer.insert(buffer.end(), chunk, chunk + n);
+        fclose(f);
+
+        data = buffer.data();
+        size = buffer.size();
+    }
+
+    ~Mapping()
+    {
+#ifndef _WIN32
+        if (mapped)
+            munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    const char *data = NULL;
+    size_t size = 0;
+
+private:
+    std::vector<char> buffer;   // operator new: aligned for doubles
+    bool mapped = false;
+};
+
+static void number(std::string &out, double value, bool json)
+{
+    char buf[32];
+
+    if (!isfinite(value))
+    {
+        out += json ? "null" : "";
+        return;
+    }
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, r.ptr);
+#else
+    out.append(buf, size_t(snprintf(buf, sizeof(buf), "%.17g", value)));
+#endif
+}
+
+static void text(std::string &out, const char *s, size_t length, bool json)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char) s[i];
+
+        if (c == '"')
+            out += json ? "\\\"" : "\"\"";
+        else if (json && c == '\\')
+            out += "\\\\";
+        else if (json && c < 0x20)
+        {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+        else
+            out += char(c);
+    }
+    out += '"';
+}
+
+static const char *csv_header =
+    "Type,Location,Format,Codec,Loudness [LUFS],Range [LU],True Peak,True Peak [dBTP],Reference [LUFS],"
+    "Will clip,Clip prevent,Gain [dB],New Peak,New Peak [dBTP],"
+    "Album Loudness [LUFS],Album Range [LU],Album Peak,Album Gain [dB]\n";
+
+static const char *json_names[ResultBlockLayout::DOUBLES] = {
+    "loudness", "range", "peak", "reference", "gain", "new_peak",
+    "album_loudness", "album_range", "album_peak", "album_gain"
+};
+
+static bool dump_block(const char *block, const ResultBlockHeader &header, bool json)
+{
+    ResultBlockLayout layout(header.rows, header.names, header.stringBytes);
+    const double *doubles[ResultBlockLayout::DOUBLES];
+    const uint32_t *path = reinterpret_cast<const uint32_t *>(block + layout.path);
+    const uint32_t *name = reinterpret_cast<const uint32_t *>(block + layout.name);
+    const uint16_t *format = reinterpret_cast<const uint16_t *>(block + layout.format);
+    const uint16_t *codec = reinterpret_cast<const uint16_t *>(block + layout.codec);
+    const uint16_t *flags = reinterpret_cast<const uint16_t *>(block + layout.flags);
+    const char *strings = block + layout.strings;
+    std::string out;
+
+    for (int i = 0; i < ResultBlockLayout::DOUBLES; i++)
+        doubles[i] = reinterpret_cast<const double *>(block + layout.doubles[i]);
+
+    for (uint32_t row = 0; row < header.rows; row++)
+    {
+        bool album = flags[row] & RESULT_ALBUM;
+        double peak = doubles[ResultBlockLayout::PEAK][row];
+        double newPeak = doubles[ResultBlockLayout::NEW_PEAK][row];
+
+        if (path[row] > path[row + 1] || path[row + 1] > header.stringBytes ||
+            format[row] >= header.names || codec[row] >= header.names ||
+            name[format[row] + 1] > header.stringBytes || name[codec[row] + 1] > header.stringBytes)
+            return false;
+
+        if (json)
+        {
+            out += album ? "{\"type\":\"album\",\"directory\":" : "{\"type\":\"track\",\"path\":";
+            text(out, strings + path[row], path[row + 1] - path[row], true);
+            if (!album)
+            {
+                out += ",\"format\":";
+                text(out, strings + name[format[row]], name[format[row] + 1] - name[format[row]], true);
+                out += ",\"codec\":";
+                text(out, strings + name[codec[row]], name[codec[row] + 1] - name[codec[row]], true);
+            }
+            for (int i = 0; i < ResultBlockLayout::DOUBLES; i++)
+            {
+                if (i >= ResultBlockLayout::ALBUM_LOUDNESS && !(flags[row] & RESULT_HAS_ALBUM))
+                    break;
+                out += ",\"";
+                out += json_names[i];
+                out += "\":";
+                number(out, doubles[i][row], true);
+            }
+            out += ",\"peak_dbtp\":";
+            number(out, 20.0 * log10(peak), true);
+            out += ",\"new_peak_dbtp\":";
+            number(out, 20.0 * log10(newPeak), true);
+            out += (flags[row] & RESULT_CLIPS) ? ",\"clips\":true" : ",\"clips\":false";
+            out += (flags[row] & RESULT_CLIP_PREVENTION) ? ",\"clip_prevention\":true}\n" : ",\"clip_prevention\":false}\n";
+        }
+        else
+        {
+            out += album ? "Album," : "File,";
+            text(out, strings + path[row], path[row + 1] - path[row], false);
+            out += ',';
+            out.append(strings + name[format[row]], name[format[row] + 1] - name[format[row]]);
+            out += ',';
+            out.append(strings + name[codec[row]], name[codec[row] + 1] - name[codec[row]]);
+            for (int i = 0; i < ResultBlockLayout::DOUBLES; i++)
+            {
+                out += ',';
+                number(out, doubles[i][row], false);
+
+                if (i == ResultBlockLayout::PEAK)
+                {
+                    out += ',';
+                    number(out, 20.0 * log10(peak), false);
+                }
+                else if (i == ResultBlockLayout::REFERENCE)
+                {
+                    out += (flags[row] & RESULT_CLIPS) ? ",1" : ",0";
+                    out += (flags[row] & RESULT_CLIP_PREVENTION) ? ",1" : ",0";
+                }
+                else if (i == ResultBlockLayout::NEW_PEAK)
+                {
+                    out += ',';
+                    number(out, 20.0 * log10(newPeak), false);
+                }
+            }
+            out += '\n';
+        }
+
+        if (out.size() >= 65536)
+        {
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    }
+
+    fwrite(out.data(), 1, out.size(), stdout);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--csv") == 0)
+            json = false;
+        else if (path == NULL && argv[i][0] != '-')
+            path = argv[i];
+        else
+            path = NULL, i = argc;
+    }
+
+    if (path == NULL)
+    {
+        fprintf(stderr, "Usage: %s [-c|--csv] [-j|--json] FILE\n"
+                        "Converts a loudgain -b result file to CSV (default) or JSON Lines.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Mapping file(path);
+    ResultFileHeader header;
+
+    if (file.data == NULL || file.size < sizeof(header))
+    {
+        fprintf(stderr, "Failed to read file: '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != RESULT_FILE_VERSION || header.order != RESULT_FILE_ORDER)
+    {
+        fprintf(stderr, "Not a loudgain result file (or from a machine of other byte order): '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+
+    if (!json)
+        fputs(csv_header, stdout);
+
+    size_t at = ResultBlockLayout::align(sizeof(header));
+    while (at < file.size)
+    {
+        ResultBlockHeader block;
+
+        if (file.size - at < sizeof(block))
+            break;
+        memcpy(&block, file.data + at, sizeof(block));
+
+        if (memcmp(block.magic, RESULT_BLOCK_MAGIC, sizeof(block.magic)) != 0 ||
+            ResultBlockLayout(block.rows, block.names, block.stringBytes).size > file.size - at ||
+            !dump_block(file.data + at, block, json))
+        {
+            fprintf(stderr, "Corrupt block at offset %zu in '%s'\n", at, path);
+            return EXIT_FAILURE;
+        }
+
+        at += ResultBlockLayout(block.rows, block.names, block.stringBytes).size;
+    }
+
+    return EXIT_SUCCESS;
+}